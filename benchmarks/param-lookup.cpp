@@ -0,0 +1,42 @@
+/* Parameter lookup by `clap_id`: a linear scan of the parameter list, compared with `ParamManager::paramsGetValue()` (which uses a `ParamIndex`), for random existing IDs.
+*/
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <memory>
+#include "signalsmith-clap/params.h"
+using namespace signalsmith::clap;
+int main() {
+	for (size_t n : {1, 32, 1000}) {
+		std::vector<std::unique_ptr<Param>> owned;
+		ParamManager manager;
+		std::vector<Param *> list;
+		std::mt19937 rng(n);
+		for (size_t i = 0; i < n; ++i) {
+			owned.emplace_back(new Param("p", "p", rng(), 0, 0.5, 1));
+			manager.add(*owned.back());
+			list.push_back(owned.back().get());
+		}
+		std::vector<clap_id> queries(4096);
+		for (auto &q : queries) q = list[rng()%n]->info.id;
+		size_t reps = 20000000/queries.size();
+		double sum = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < reps; ++r) for (auto id : queries) {
+			for (auto *p : list) if (p->info.id == id) {sum += p->value; break;}
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < reps; ++r) for (auto id : queries) {
+			double v; if (manager.paramsGetValue(id, &v)) sum += v;
+		}
+		auto t2 = std::chrono::steady_clock::now();
+		double count = reps*queries.size();
+		printf("%5zu params: linear %7.2f ns/lookup, index %5.2f ns/lookup (%g)\n", n,
+			std::chrono::duration<double, std::nano>(t1 - t0).count()/count,
+			std::chrono::duration<double, std::nano>(t2 - t1).count()/count, sum);
+		// correctness
+		for (auto *p : list) if (manager.find(p->info.id) != p) printf("lookup returned the wrong parameter\n");
+		if (manager.find(12345) && manager.find(12345)->info.id != 12345) printf("lookup found a missing ID\n");
+	}
+}
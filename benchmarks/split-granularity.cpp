@@ -0,0 +1,117 @@
+/* Task-split granularity (`NoteManager::splitGranularity`): 16 held MPE notes with random per-channel pressure/tuning changes, rendered with a cheap saw kernel and per-task setup like the example synth.
+
+Run with `--check` to instead test that (for several grids) every note's tasks are contiguous and non-negative, and that all non-start split points are on the grid.
+*/
+#include <cstring>
+#include <random>
+#include <cstdio>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include "signalsmith-clap/note-manager.h"
+using NM = signalsmith::clap::NoteManager;
+static bool push(const clap_output_events *, const clap_event_header *) { return true; }
+
+// Invariants: per note, tasks are contiguous and non-negative, and non-start split points are on the grid
+size_t check(uint32_t grid, int seed) {
+	NM nm(16);
+	nm.splitGranularity = grid;
+	clap_output_events out{nullptr, push};
+	std::mt19937 rng(seed);
+	size_t bad = 0;
+	for (int block = 0; block < 3000; ++block) {
+		nm.startBlock();
+		std::map<int32_t, uint32_t> reached; // noteId -> processed up to
+		std::map<int32_t, uint32_t> starts;
+		auto take = [&](const NM::Tasks &tasks) {
+			for (auto &t : tasks) {
+				if (t.processTo < t.processFrom) ++bad;
+				auto id = t->noteId;
+				if (t.state == NM::stateDown || (t.state == NM::stateLegato && !reached.count(id))) { reached[id] = t.processFrom; starts[id] = t.processFrom; }
+				if (reached.count(id) && reached[id] != t.processFrom) ++bad;
+				if (!reached.count(id) && t.processFrom != 0) ++bad;
+				reached[id] = t.processTo;
+				bool exactEnd = (t.processTo == 256) || t.state == NM::stateKill || (starts.count(id) && t.processTo == starts[id]);
+				if (!exactEnd && grid > 1 && t.processTo%grid) ++bad;
+			}
+		};
+		for (uint32_t t = 0; t < 256; t += 1 + rng()%12) {
+			int kind = rng()%5;
+			clap_event_note ne{{sizeof(clap_event_note), t, 0, CLAP_EVENT_NOTE_ON, 0}, -1, 0, int16_t(rng()%4), int16_t(rng()%8), 0.5};
+			if (kind == 0) {
+				auto n = nm.wouldStart(&ne.header);
+				if (rng()%4 == 0 && nm.size()) { auto other = nm[rng()%nm.size()]; if (!other.released()) { take(nm.legato(*n, other, &out)); continue; } }
+				take(nm.start(*n, &out));
+			} else if (kind == 1) {
+				ne.header.type = CLAP_EVENT_NOTE_OFF;
+				take(nm.processEvent(&ne.header, &out));
+			} else {
+				clap_event_note_expression ex{{sizeof(ex), t, 0, CLAP_EVENT_NOTE_EXPRESSION, 0}, CLAP_NOTE_EXPRESSION_PRESSURE, -1, -1, int16_t(rng()%4), -1, 0.5};
+				take(nm.processEvent(&ex.header, &out));
+			}
+		}
+		auto &final = nm.processTo(256);
+		take(final);
+		for (auto &t : final) if (t.released() && rng()%2) nm.stop(t, &out);
+	}
+	return bad;
+}
+
+double bench(uint32_t grid, size_t &taskCount, float &sink, uint32_t eventStep) {
+	NM nm(16);
+	nm.splitGranularity = grid;
+	clap_output_events out{nullptr, push};
+	std::mt19937 rng(1);
+	float sampleRate = 48000;
+	std::vector<float> phases(16, 0), buffer(256);
+	// 16 held MPE notes, one per channel
+	nm.startBlock();
+	for (int c = 0; c < 16; ++c) {
+		clap_event_note ne{{sizeof(clap_event_note), 0, 0, CLAP_EVENT_NOTE_ON, 0}, -1, 0, int16_t(c), int16_t(48 + c), 0.8};
+		nm.processEvent(&ne.header, &out);
+	}
+	auto render = [&](const NM::Tasks &tasks) {
+		for (auto &task : tasks) {
+			++taskCount;
+			// per-task setup, like the example synth
+			float hz = 440*std::exp2((task->key - 69)/12);
+			float normFreq = hz/sampleRate, amp = task->pressure*task->volume;
+			float &phase = phases[task.voiceIndex];
+			for (uint32_t i = task.processFrom; i < task.processTo; ++i) {
+				phase += normFreq;
+				buffer[i] += amp*(phase - std::floor(phase) - 0.5f);
+			}
+			phase -= std::floor(phase);
+		}
+	};
+	auto start = std::chrono::steady_clock::now();
+	for (int block = 0; block < 20000; ++block) {
+		if (block) nm.startBlock();
+		std::fill(buffer.begin(), buffer.end(), 0);
+		// MPE pressure/tuning events, spread across the channels
+		for (uint32_t t = 0; t < 256; t += eventStep) {
+			clap_event_note_expression ex{{sizeof(ex), t, 0, CLAP_EVENT_NOTE_EXPRESSION, 0}, (rng()%2) ? CLAP_NOTE_EXPRESSION_PRESSURE : CLAP_NOTE_EXPRESSION_TUNING, -1, -1, int16_t(rng()%16), -1, (rng()%100)/100.0};
+			render(nm.processEvent(&ex.header, &out));
+		}
+		render(nm.processTo(256));
+		sink += buffer[rng()%256];
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && !std::strcmp(argv[1], "--check")) {
+		for (uint32_t grid : {1, 4, 8, 16, 32}) std::printf("grid %u: bad %zu\n", grid, check(grid, 1) + check(grid, 2));
+		return 0;
+	}
+	float sink = 0;
+	for (uint32_t step : {4, 1}) {
+		std::printf("events every %u samples:\n", step);
+		for (uint32_t grid : {1, 8, 16, 32}) {
+			double best = 1e10; size_t tasks = 0;
+			for (int r = 0; r < 3; ++r) { tasks = 0; best = std::min(best, bench(grid, tasks, sink, step)); }
+			std::printf("  grid %2u: %.1f ms, %.1f tasks/block, %.1f Msamples/s\n", grid, best, tasks/20000.0, 16*256*20000/best/1000);
+		}
+	}
+	std::printf("(%g)\n", sink);
+}
@@ -0,0 +1,94 @@
+/* Writing state through a `StreamBuffer`, compared with building the whole CBOR document in a `std::vector` first.  The state is a 2 MB float wavetable plus 16 zones of int16 samples.
+
+Heap use is measured by replacing `operator new`/`delete`.  It also checks that the output is identical when the host only accepts 1000 bytes per write, and that a failing sink stops after the first call.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include "signalsmith-clap/storage.h"
+static size_t live = 0, peak = 0, allocCount = 0;
+void * operator new(size_t n) { size_t *p = (size_t *)std::malloc(n + 16); *p = n; live += n; ++allocCount; if (live > peak) peak = live; return p + 2; }
+void operator delete(void *p) noexcept { if (!p) return; size_t *b = (size_t *)p - 2; live -= *b; std::free(b); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+struct Zone {
+	int root = 60; float gain = 1; std::string name = "zone";
+	std::vector<int16_t> sample;
+	template<class S> void state(S &s) { s("root", root); s("gain", gain); s("name", name); s("sample", sample); }
+};
+struct State {
+	double volume = 0.5; std::vector<float> wavetable; std::vector<Zone> zones; std::vector<double> small{1, 2, 3};
+	template<class S> void state(S &s) { s("volume", volume); s("wavetable", wavetable); s("zones", zones); s("small", small); }
+};
+struct FakeStream { // like a host which accepts at most `maxChunk` bytes per write
+	std::vector<unsigned char> received; size_t maxChunk; size_t calls = 0;
+	bool write(const void *data, size_t length) {
+		size_t index = 0;
+		while (index < length) { // what writeAllToStream() does with partial writes
+			size_t n = std::min(maxChunk, length - index);
+			received.insert(received.end(), (const unsigned char *)data + index, (const unsigned char *)data + index + n);
+			index += n; ++calls;
+		}
+		return true;
+	}
+};
+int main() {
+	State state;
+	state.wavetable.resize(256*2048);
+	for (size_t i = 0; i < state.wavetable.size(); ++i) state.wavetable[i] = std::sin(i*0.01f);
+	for (int z = 0; z < 16; ++z) {
+		state.zones.emplace_back();
+		state.zones.back().sample.resize(48000*2, int16_t(z));
+		state.zones.back().root = 36 + z;
+	}
+	size_t baseline = live;
+	std::vector<unsigned char> vectorBytes;
+	FakeStream vectorOut{{}, 65536};
+	vectorOut.received.reserve(8 << 20);
+	FakeStream streamOut{{}, 65536};
+	streamOut.received.reserve(8 << 20);
+	baseline = live;
+
+	peak = live; size_t a0 = allocCount;
+	auto t0 = std::chrono::steady_clock::now();
+	{
+		std::vector<unsigned char> bytes;
+		signalsmith::storage::StorageCborWriter writer(bytes);
+		writer.writeObject(state);
+		vectorOut.write(bytes.data(), bytes.size());
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	size_t vectorPeak = peak - baseline, vectorAllocs = allocCount - a0;
+
+	peak = live; a0 = allocCount;
+	auto t2 = std::chrono::steady_clock::now();
+	size_t streamed;
+	{
+		signalsmith::storage::StreamBuffer buffer([&](const void *data, size_t length){
+			return streamOut.write(data, length);
+		});
+		signalsmith::storage::StorageCborWriter writer(buffer);
+		writer.writeObject(state);
+		buffer.flush();
+		streamed = buffer.bytesWritten();
+	}
+	auto t3 = std::chrono::steady_clock::now();
+	size_t streamPeak = peak - baseline, streamAllocs = allocCount - a0;
+	bool same = vectorOut.received == streamOut.received;
+	std::printf("document %zu bytes (streamed count %zu), identical output: %s\n", vectorOut.received.size(), streamed, same ? "yes" : "NO");
+	std::printf("vector path: peak +%zu bytes, %zu allocs, %.2f ms\n", vectorPeak, vectorAllocs, std::chrono::duration<double, std::milli>(t1 - t0).count());
+	std::printf("stream path: peak +%zu bytes, %zu allocs, %.2f ms\n", streamPeak, streamAllocs, std::chrono::duration<double, std::milli>(t3 - t2).count());
+	// partial writes: host accepts 1000 bytes at a time
+	FakeStream tiny{{}, 1000};
+	signalsmith::storage::StreamBuffer b2([&](const void *d, size_t n){ return tiny.write(d, n); }, 1024);
+	signalsmith::storage::StorageCborWriter w2(b2);
+	w2.writeObject(state); b2.flush();
+	std::printf("1000-byte partial writes: %zu calls, identical: %s\n", tiny.calls, tiny.received == vectorOut.received ? "yes" : "NO");
+	// failing sink
+	size_t failCalls = 0;
+	signalsmith::storage::StreamBuffer b3([&](const void *, size_t){ ++failCalls; return false; });
+	signalsmith::storage::StorageCborWriter w3(b3);
+	w3.writeObject(state);
+	std::printf("failing sink: good() %d after %zu sink call(s)\n", b3.flush(), failCalls);
+	return !same || tiny.received != vectorOut.received || failCalls != 1;
+}
@@ -0,0 +1,64 @@
+/* Voice stealing at full polyphony: `NoteManager::stealHeap` (an indexed min-heap of victims) compared with `stealScan` (checking every note's cost), for several polyphony sizes.
+
+Every block has 64 note events (one in three is a note-off), so after the first few blocks almost every note-on has to steal a voice.  It also checks that both modes steal the same number of notes.
+*/
+#include <cstring>
+#include <cstdio>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "signalsmith-clap/note-manager.h"
+
+using NoteManager = signalsmith::clap::NoteManager;
+static bool push(const clap_output_events *, const clap_event_header *) {
+	return true;
+}
+
+struct Result {
+	double ms = 0;
+	size_t noteOns = 0, steals = 0;
+};
+
+Result bench(size_t polyphony, NoteManager::VoiceStealing mode) {
+	clap_output_events out{nullptr, push};
+	NoteManager noteManager(polyphony);
+	noteManager.voiceStealing = mode;
+	std::mt19937 rng(5);
+	Result result;
+	int32_t noteId = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int block = 0; block < 4000; ++block) {
+		noteManager.startBlock();
+		uint32_t time = 0;
+		for (int e = 0; e < 64; ++e) {
+			time += 1 + rng()%3;
+			clap_event_note event{{sizeof(clap_event_note), time, 0, CLAP_EVENT_NOTE_ON, 0}, noteId++, 0, int16_t(rng()%16), int16_t(rng()%128), 0.5};
+			if (rng()%3 == 0) {
+				event.header.type = CLAP_EVENT_NOTE_OFF;
+				event.note_id = noteId - 1 - int32_t(rng()%(polyphony + 1));
+				noteManager.processEvent(&event.header, &out);
+				continue;
+			}
+			++result.noteOns;
+			for (auto &task : noteManager.processEvent(&event.header, &out)) {
+				if (task.state == NoteManager::stateKill) ++result.steals;
+			}
+		}
+		noteManager.processTo(256);
+	}
+	result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+int main() {
+	for (size_t polyphony : {8, 16, 64, 256, 1024}) {
+		Result heap, scan;
+		heap.ms = scan.ms = 1e10;
+		for (int repeat = 0; repeat < 3; ++repeat) {
+			auto h = bench(polyphony, NoteManager::stealHeap), s = bench(polyphony, NoteManager::stealScan);
+			if (h.ms < heap.ms) heap = h;
+			if (s.ms < scan.ms) scan = s;
+		}
+		std::printf("polyphony %4zu: heap %6.1f ns/note-on, scan %7.1f ns/note-on (%zu steals%s)\n", polyphony, heap.ms*1e6/heap.noteOns, scan.ms*1e6/scan.noteOns, heap.steals, heap.steals == scan.steals ? "" : ", MISMATCH");
+	}
+}
@@ -5,6 +5,11 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#	include <bit>
+#endif
 
 namespace signalsmith { namespace clap {
 
@@ -54,6 +59,33 @@ struct ClapPluginMemberMethodHelper<Object Plugin::*, Return (Object::*)(Args...
 	}
 };
 
+// ---- bit helpers, for 64-bit masks of voices/parameters ----
+
+namespace _impl {
+	inline size_t popCount64(uint64_t x) {
+#if defined(__cpp_lib_bitops)
+		return size_t(std::popcount(x));
+#elif defined(__GNUC__) || defined(__clang__)
+		return size_t(__builtin_popcountll(x));
+#else
+		x = x - ((x >> 1)&0x5555555555555555ull);
+		x = (x&0x3333333333333333ull) + ((x >> 2)&0x3333333333333333ull);
+		x = (x + (x >> 4))&0x0F0F0F0F0F0F0F0Full;
+		return size_t((x*0x0101010101010101ull) >> 56);
+#endif
+	}
+	// Index of the lowest set bit (`x` must be non-zero)
+	inline size_t lowestBit64(uint64_t x) {
+#if defined(__cpp_lib_bitops)
+		return size_t(std::countr_zero(x));
+#elif defined(__GNUC__) || defined(__clang__)
+		return size_t(__builtin_ctzll(x));
+#else
+		return popCount64((x&(~x + 1)) - 1);
+#endif
+	}
+}
+
 // ---- checks for a host extension ----
 
 template<class HostExtension>
@@ -64,17 +96,26 @@ bool getHostExtension(const clap_host *host, const char *extId, const HostExtens
 
 // ---- read/write strings or byte-vectors using CLAP stream(s) ----
 
+// Reads in chunks which double while the host keeps filling them, and grows the container geometrically, so large states only take a few reads/reallocations.  If you have a size hint, `.reserve()` the container first.
 template<class Container>
 bool readAllFromStream(Container &byteContainer, const clap_istream *istream, size_t chunkBytes=1024) {
+	const size_t minChunkBytes = chunkBytes;
+	chunkBytes = std::max(chunkBytes, size_t(byteContainer.capacity() - byteContainer.size())); // read straight into any reserved space
 	while (1) {
 		size_t index = byteContainer.size();
-		byteContainer.resize(index + chunkBytes);
-		int64_t result = istream->read(istream, (void *)&byteContainer[index], uint64_t(chunkBytes));
-		if (result == chunkBytes) {
+		if (byteContainer.capacity() < index + minChunkBytes) {
+			byteContainer.reserve(std::max(index*2, index + chunkBytes));
+		}
+		size_t readBytes = std::min(chunkBytes, size_t(byteContainer.capacity() - index));
+		byteContainer.resize(index + readBytes);
+		int64_t result = istream->read(istream, (void *)&byteContainer[index], uint64_t(readBytes));
+		if (result == int64_t(readBytes)) {
+			chunkBytes = std::max(chunkBytes, readBytes*2);
 			continue;
 		} else if (result >= 0) {
 			byteContainer.resize(index + result);
 			if (result == 0) return true;
+			chunkBytes = std::max(minChunkBytes, size_t(result)*2); // so we're not clearing much more than the host gives us
 		} else {
 			return false;
 		}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "./cpp.h"
+
 #include "clap/events.h"
 
 #include <vector>
@@ -7,28 +9,150 @@
 #include <optional>
 #include <cmath>
 #include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include <cassert>
 
 namespace signalsmith { namespace clap {
 
+namespace _impl {
+	/* A minimal `std::vector` replacement with fixed capacity, used by `FixedNoteManager`.
+
+	Adding items past the capacity drops them (counted in `.dropped`) instead of writing out of bounds, and asserts in debug builds. */
+	template<class T, size_t maxSize>
+	struct FixedVector {
+		size_t dropped = 0;
+
+		void reserve(size_t) {}
+		void resize(size_t n) {
+			assert(n <= maxSize);
+			if (n > maxSize) dropped += n - maxSize;
+			count = std::min(n, maxSize);
+		}
+		void assign(size_t n, const T &value) {
+			resize(n);
+			std::fill(begin(), end(), value);
+		}
+		void clear() {
+			count = 0;
+		}
+		size_t size() const {
+			return count;
+		}
+		bool empty() const {
+			return count == 0;
+		}
+		bool push_back(const T &value) {
+			assert(count < maxSize);
+			if (count >= maxSize) {
+				++dropped;
+				return false;
+			}
+			items[count++] = value;
+			return true;
+		}
+		void pop_back() {
+			assert(count > 0);
+			--count;
+		}
+
+		T & operator[](size_t i) {
+			return items[i];
+		}
+		const T & operator[](size_t i) const {
+			return items[i];
+		}
+		T & back() {
+			return items[count - 1];
+		}
+		const T & back() const {
+			return items[count - 1];
+		}
+		T * data() {
+			return items.data();
+		}
+		const T * data() const {
+			return items.data();
+		}
+		T * begin() {
+			return items.data();
+		}
+		T * end() {
+			return items.data() + count;
+		}
+		const T * begin() const {
+			return items.data();
+		}
+		const T * end() const {
+			return items.data() + count;
+		}
+	private:
+		std::array<T, maxSize> items;
+		size_t count = 0;
+	};
+	
+	template<class V>
+	size_t droppedCount(const V &) {
+		return 0; // `std::vector` grows instead
+	}
+	template<class T, size_t maxSize>
+	size_t droppedCount(const FixedVector<T, maxSize> &vector) {
+		return vector.dropped;
+	}
+	
+	// Note ID hash table: at most half-full, and a power of 2
+	constexpr size_t noteIdTableSize(size_t polyphony) {
+		size_t tableSize = 4;
+		while (tableSize < polyphony*2) tableSize *= 2;
+		return tableSize;
+	}
+}
+
 /* This helper handles CLAP note events, and returns "note tasks", which are sub-blocks for processing each note.  A note's tasks will have a consistent `voiceIndex` (up to the specified polyphony), exclusive to that note it's `.stop()`ed or stolen.
 
-When you hand it an event (and it returns `true`), it returns tasks to process any affected notes up to that point.  You can also request all notes be processed up to a certain block index, which should be used for completing a block, or for any sample-accurate parameter/etc. changes which affect all notes.
+When you hand it an event (and it returns `true`), it returns tasks to process any affected notes up to that point.  Tasks are small handles (voice index, state and range) which point to the note's info, so nothing is copied per-note - but the list (and the info it points to) is only valid until the next call which changes the notes.  You can also request all notes be processed up to a certain block index, which should be used for completing a block, or for any sample-accurate parameter/etc. changes which affect all notes.
+
+Internally, the fields needed for block scheduling (state, processing range, voice index, age) are kept in dense arrays, and everything else (IDs, key, velocity, note expressions as `float`s) is stored per-voice.  The `Note` struct is a copy of a single note's info, used for incoming events and when iterating through the active notes.
 
-It implements voice-stealing based on time since a note's release (if released) or attack.  This is represented by a note-task with `stateKill`.  The length (`processFrom`/`processTo`) of this task will not overlap with the new note - which unavoidably means it *may* be 0, in which case you can process a bit more to avoid clicks at your discretion.
+This is the only storage layout - there's no `std::vector<Note>` mode any more - but the `Note` API is still available as a view over it: `activeNotes()` returns the manager itself (not a vector), and iterating or indexing it gives `Note` copies (so changing them doesn't change the stored note).  Tasks are `Task` handles (with the note info as `task->key` etc.), which convert to a `Note` copy, so voice code taking a `const Note &` can be passed a task directly.  Expressions are stored as `float`, so they come back rounded.
+
+It implements voice-stealing based on time since a note's release (if released) or attack.  This is represented by a note-task with `stateKill`.  By default the victim comes from an indexed min-heap (so a note-on is O(log N) even with full polyphony), but `.voiceStealing = stealScan` checks every note's cost instead.  Custom costs from `.setVoiceKillCosts()` can change at any time, so those always use the scan.  The length (`processFrom`/`processTo`) of this task will not overlap with the new note - which unavoidably means it *may* be 0, in which case you can process a bit more to avoid clicks at your discretion.
+
+`NoteManager` has its polyphony set at runtime.  `FixedNoteManager<N>` has it fixed at compile-time, with all the per-note storage inline (no heap allocations), so it can live directly in the plugin object.  The buffers for `translateEvents()`, `scheduleBlock()` and `expressionsAsEvents` are still `std::vector`s for both, since their size depends on the number of events.  These are allocated in the constructor (for 1024 events per block), so they only allocate on the audio thread if a block has more events than that - call `.reserveEvents()` from the main thread (e.g. when activating) if you expect more.  If a `FixedNoteManager`'s task list is ever full, extra tasks are dropped (and counted by `.droppedTasks()`) rather than overflowing.
 */
-struct NoteManager {
-	enum State{stateDown, stateLegato, stateContinue, stateUp, stateRelease, stateKill};
+template<size_t fixedPolyphony=0>
+struct BasicNoteManager {
+	// Storage for up to `maxSize` items, which doesn't allocate when the polyphony is fixed
+	template<class T, size_t maxSize=fixedPolyphony>
+	using Storage = typename std::conditional<fixedPolyphony == 0, std::vector<T>, _impl::FixedVector<T, maxSize>>::type;
+
+	enum State : uint8_t {stateDown, stateLegato, stateContinue, stateUp, stateRelease, stateKill};
 	
 	// 2 for default MIDI, 48 for most MPE
 	double pitchWheelRange = 2;
 	bool legatoResetsAge = true, releaseResetsAge = true;
 	
+	// How to find the cheapest note to steal when polyphony is full
+	enum VoiceStealing {stealHeap, stealScan};
+	VoiceStealing voiceStealing = stealHeap;
+	
+	/* If this is 0, the most recently freed voice is reused first.  Otherwise (power of 2, up to 64) new notes are packed into groups of `laneWidth` voices, preferring the fullest group which has space, so SIMD voice code has fewer groups to process.  Use `laneBits()` to find which lanes of a group are in use.  Any other width is an error: `start()` rejects new notes (ending them, and returning no tasks) until it's fixed. */
+	size_t laneWidth = 0;
+	
+	/* Legato, release and note-expression changes split notes into separate tasks.  If this is more than 1, those split points are rounded down to a multiple of this many samples (from the start of the block), so lots of small changes (e.g. MPE pressure) don't create lots of tiny tasks.  Note starts and stolen notes are still exact. */
+	uint32_t splitGranularity = 1;
+	
+	/* By default, a note-expression change splits the note into a new task.  With `expressionsAsEvents`, it's instead added to a list for the voice, and the task covering it lists the changes with `expressions(task)`, so the voice can follow them sample-accurately inside one longer task.  In that case, the task's note info (`task->pressure` etc.) is the value at the *start* of the task, and the stored note info is updated at the end of each task. */
+	enum NoteExpressions {expressionsSplitTasks, expressionsAsEvents};
+	NoteExpressions noteExpressions = expressionsSplitTasks;
+	
 	struct NoteMod;
+	struct Task;
 	
 	struct Note {
 		// Note info
 		size_t voiceIndex;
-		double key, velocity;
+		double key, velocity, releaseVelocity = 0;
 		// Note expression (possibly translated from MIDI CCs)
 		double volume = 1, pan = 0.5, mod = 0, expression = 1, brightness = 0.5, pressure = 1;
 		int16_t port, channel;
@@ -75,9 +199,11 @@ struct NoteManager {
 		int32_t noteId;
 		int16_t baseKey;
 	private:
-		friend class NoteManager;
+		friend struct BasicNoteManager;
+		friend struct Task;
 
 		Note(size_t voiceIndex, const clap_event_note &e, State state=stateDown) : voiceIndex(voiceIndex), key(e.key), velocity(e.velocity), port(e.port_index), channel(e.channel), state(state), processFrom(e.header.time), processTo(e.header.time), noteId(e.note_id), baseKey(e.key) {}
+		Note() {}
 		size_t age = 0; // since start/legato/up
 	};
 	struct NoteMod {
@@ -90,7 +216,9 @@ struct NoteManager {
 		int32_t noteId;
 		int16_t baseKey;
 
-		void applyTo(Note &note) const {
+		// Works for `Note`, or anything else with the same expression fields
+		template<class NoteLike>
+		void applyTo(NoteLike &note) const {
 			if (expression == CLAP_NOTE_EXPRESSION_VOLUME) {
 				note.volume = value;
 			} else if (expression == CLAP_NOTE_EXPRESSION_PAN) {
@@ -114,20 +242,201 @@ struct NoteManager {
 	};
 	using OptionalNote = std::optional<Note>;
 	using OptionalNoteMod = std::optional<NoteMod>;
+
+	// Space for a note/expression event translated from MIDI
+	union TranslatedEvent {
+		clap_event_header header;
+		clap_event_note note;
+		clap_event_note_expression noteExpression;
+	};
+	// An input event, with its translation (if it was MIDI we understand)
+	struct InputEvent {
+		const clap_event_header *original;
+		bool translated;
+		TranslatedEvent translation;
+
+		const clap_event_header * event() const {
+			return translated ? &translation.header : original;
+		}
+	};
 	
-	NoteManager(size_t polyphony=64, double pitchWheelRange=2) : pitchWheelRange(pitchWheelRange) {
-		notes.reserve(polyphony);
-		tasks.reserve(polyphony);
+	// MIDI CC -> note expression (or -1 to ignore), with the value mapped linearly to 0-1 (except volume, where CC=100 is 1)
+	std::array<clap_note_expression, 128> ccExpressions;
+
+	// Per-voice note info, which doesn't move while the note is active
+	struct NoteData {
+		double key, velocity, releaseVelocity;
+		float volume, pan, mod, expression, brightness, pressure;
+		int32_t noteId;
+		int16_t port, channel, baseKey;
+	};
+	// A handle for processing part of a note, with the rest of the note's info available as `task->key` etc.
+	struct Task {
+		size_t voiceIndex;
+		State state;
+		uint32_t processFrom, processTo;
+
+		bool released() const {
+			return state == stateUp || state == stateRelease || state == stateKill;
+		}
+		const NoteData * operator->() const {
+			return data;
+		}
+		const NoteData & note() const {
+			return *data;
+		}
+		size_t ageAt(uint32_t timeInBlock) const {
+			return age + (timeInBlock - processFrom);
+		}
+		
+		// A full `Note` (as tasks were before the SoA layout), so voice code written for `const Note &` still works
+		operator Note() const {
+			Note note;
+			note.voiceIndex = voiceIndex;
+			note.state = state;
+			note.processFrom = processFrom;
+			note.processTo = processTo;
+			note.age = age;
+			note.key = data->key;
+			note.velocity = data->velocity;
+			note.releaseVelocity = data->releaseVelocity;
+			note.volume = data->volume;
+			note.pan = data->pan;
+			note.mod = data->mod;
+			note.expression = data->expression;
+			note.brightness = data->brightness;
+			note.pressure = data->pressure;
+			note.port = data->port;
+			note.channel = data->channel;
+			note.noteId = data->noteId;
+			note.baseKey = data->baseKey;
+			return note;
+		}
+
+		// Empty task, so they can be stored in fixed-capacity arrays
+		Task() : voiceIndex(0), state(stateContinue), processFrom(0), processTo(0), data(nullptr), age(0), firstExpression(uint32_t(-1)) {}
+	private:
+		friend struct BasicNoteManager;
+		const NoteData *data;
+		size_t age; // at `processFrom`
+
+		uint32_t firstExpression; // index into the manager's expression list, if there are any
+
+		Task(size_t voiceIndex, State state, uint32_t processFrom, uint32_t processTo, const NoteData *data, size_t age, uint32_t firstExpression) : voiceIndex(voiceIndex), state(state), processFrom(processFrom), processTo(processTo), data(data), age(age), firstExpression(firstExpression) {}
+	};
+	using Tasks = Storage<Task, fixedPolyphony*2>; // up to 2 per note, with a queued `release(task)`
+
+	// A task's note-expression changes, in time order (only with `expressionsAsEvents`)
+	struct Expressions {
+		struct Iterator {
+			const BasicNoteManager *manager;
+			uint32_t index;
+			
+			const NoteMod & operator*() const {
+				return manager->expressionEvents[index].noteMod;
+			}
+			const NoteMod * operator->() const {
+				return &**this;
+			}
+			Iterator & operator++() {
+				index = manager->expressionEvents[index].next;
+				return *this;
+			}
+			bool operator==(const Iterator &other) const {
+				return index == other.index;
+			}
+			bool operator!=(const Iterator &other) const {
+				return index != other.index;
+			}
+		};
+		
+		Iterator begin() const {
+			return {manager, first};
+		}
+		Iterator end() const {
+			return {manager, uint32_t(-1)};
+		}
+		bool empty() const {
+			return first == uint32_t(-1);
+		}
+	private:
+		friend struct BasicNoteManager;
+		const BasicNoteManager *manager;
+		uint32_t first;
+		
+		Expressions(const BasicNoteManager *manager, uint32_t first) : manager(manager), first(first) {}
+	};
+	// These are valid until the next `.startBlock()`, so they can also be used with `scheduleBlock()`
+	Expressions expressions(const Task &task) const {
+		return {this, task.firstExpression};
+	}
+	
+	// One bit per voice, 64 per word
+	using VoiceBits = Storage<uint64_t, (fixedPolyphony + 63)/64>;
+
+	BasicNoteManager(size_t polyphony=(fixedPolyphony ? fixedPolyphony : 64), double pitchWheelRange=2) : pitchWheelRange(pitchWheelRange) {
+		states.reserve(polyphony);
+		processFroms.reserve(polyphony);
+		processTos.reserve(polyphony);
+		slotVoices.reserve(polyphony);
+		ages.reserve(polyphony);
+		sortOrder.reserve(polyphony);
+		tasks.reserve(polyphony*2);
+		taskData.reserve(polyphony*2);
+		schedule.voiceStarts.reserve(polyphony + 1);
+		schedule.activeVoices.reserve(polyphony);
+		voiceData.resize(polyphony);
+		voiceSlots.resize(polyphony);
+		voiceIndexQueue.reserve(polyphony);
+		voiceQueuePositions.resize(polyphony);
+		activeBits.resize((polyphony + 63)/64);
+		releasingBits.resize((polyphony + 63)/64);
+		killedBits.resize((polyphony + 63)/64);
+		pendingReleaseBits.resize((polyphony + 63)/64);
+		pendingReleases.reserve(polyphony);
+		index.resize(polyphony);
+		victimHeap.resize(polyphony);
+		expressionHeads.resize(polyphony);
+		expressionTails.resize(polyphony);
+		reserveEvents(1024); // these only grow if there are more events in a block
+
+		ccExpressions.fill(-1);
+		ccExpressions[1] = CLAP_NOTE_EXPRESSION_VIBRATO;
+		ccExpressions[4] = CLAP_NOTE_EXPRESSION_BRIGHTNESS; // foot pedal, why not
+		ccExpressions[7] = CLAP_NOTE_EXPRESSION_VOLUME;
+		ccExpressions[10] = CLAP_NOTE_EXPRESSION_PAN;
+		ccExpressions[11] = CLAP_NOTE_EXPRESSION_EXPRESSION;
 		reset();
 	}
 	
 	size_t polyphony() const {
-		return notes.capacity();
+		return fixedPolyphony ? fixedPolyphony : voiceData.size();
+	}
+	
+	// How many tasks have been dropped because the fixed-capacity storage was full (always 0 for `NoteManager`)
+	size_t droppedTasks() const {
+		return _impl::droppedCount(tasks) + _impl::droppedCount(taskData);
+	}
+	
+	// Allocates the event-sized buffers, so blocks with up to this many events don't allocate
+	void reserveEvents(size_t events) {
+		inputEvents.reserve(events);
+		expressionEvents.reserve(events);
+		size_t segments = events + polyphony()*2;
+		schedule.segments.reserve(segments);
+		schedule.pending.reserve(segments);
+		schedule.pendingData.reserve(segments);
+		schedule.data.reserve(segments);
 	}
 	
 	void reset() {
-		notes.clear();
-		tasks.clear();
+		clearSlots();
+		clearTasks();
+		index.clear();
+		victimHeap.clear();
+		expressionEvents.clear();
+		std::fill(expressionHeads.begin(), expressionHeads.end(), noExpression);
+		std::fill(expressionTails.begin(), expressionTails.end(), noExpression);
 		for (auto &channel : channelNoteExpressions) {
 			channel = {
 				1.0, // volume
@@ -142,26 +451,41 @@ struct NoteManager {
 
 		voiceIndexQueue.clear();
 		for (size_t i = 0; i < polyphony(); ++i) {
-			voiceIndexQueue.push_back(polyphony() - 1 - i);
+			pushFreeVoice(polyphony() - 1 - i);
 		}
+		std::fill(activeBits.begin(), activeBits.end(), 0);
+		std::fill(releasingBits.begin(), releasingBits.end(), 0);
+		std::fill(killedBits.begin(), killedBits.end(), 0);
 	}
 	
 	void startBlock() {
-		tasks.clear();
-		for (auto &n : notes) n.processFrom = n.processTo = 0;
+		clearTasks();
+		// Any changes which weren't part of a task (e.g. `.processTo()` wasn't used at the end of the block)
+		for (auto voice : slotVoices) {
+			for (uint32_t e = expressionHeads[voice]; e != noExpression; e = expressionEvents[e].next) {
+				expressionEvents[e].noteMod.applyTo(voiceData[voice]);
+			}
+			expressionHeads[voice] = expressionTails[voice] = noExpression;
+		}
+		expressionEvents.clear();
+		std::fill(killedBits.begin(), killedBits.end(), 0);
+		std::fill(processFroms.begin(), processFroms.end(), 0);
+		std::fill(processTos.begin(), processTos.end(), 0);
 	}
-	const std::vector<Note> & processTo(uint32_t frames) {
-		tasks.clear();
-		for (auto &n : notes) {
-			if (n.processFrom < frames) {
-				n.processTo = frames;
-				tasks.push_back(n);
-				n.age += (n.processTo - n.processFrom);
-				n.processFrom = frames;
-				if (n.state == stateDown || n.state == stateLegato) {
-					n.state = stateContinue;
-				} else if (n.state == stateUp) {
-					n.state = stateRelease;
+	const Tasks & processTo(uint32_t frames) {
+		clearTasks();
+		for (size_t i = 0; i < states.size(); ++i) {
+			if (processFroms[i] < frames) {
+				processTos[i] = frames;
+				pushTask(i);
+				ages[i] += (frames - processFroms[i]);
+				processFroms[i] = frames;
+				if (states[i] == stateDown || states[i] == stateLegato) {
+					states[i] = stateContinue;
+					victimHeap.update(slotVoices[i], stealKey(i, false));
+				} else if (states[i] == stateUp) {
+					states[i] = stateRelease;
+					victimHeap.update(slotVoices[i], stealKey(i, false));
 				}
 			}
 		}
@@ -171,7 +495,8 @@ struct NoteManager {
 	// Gets a note ready, but don't do anything with it yet
 	OptionalNote wouldStart(const clap_event_header *event) const {
 		if (event->space_id != CLAP_CORE_EVENT_SPACE_ID) return {};
-		event = translateEvent(event);
+		TranslatedEvent translated;
+		event = translateEvent(event, translated);
 		if (event->type == CLAP_EVENT_NOTE_ON) {
 			auto &noteEvent = *(const clap_event_note *)event;
 			Note newNote{size_t(-1), noteEvent};
@@ -184,66 +509,95 @@ struct NoteManager {
 
 	// You should call this if you're not using a note-on, so the host gets a NOTE_END
 	void ignore(const Note &newNote, const clap_output_events *eventsOut) {
-		sendNoteEnd(newNote, eventsOut);
+		sendNoteEnd(newNote.noteId, newNote.port, newNote.baseKey, newNote.processFrom, eventsOut);
 	}
 	
+	// Custom costs (indexed by voice) for choosing which note to steal.  These are read with `stealScan`, whatever `.voiceStealing` is.
 	void setVoiceKillCosts(float *killCosts) {
 		voiceKillCosts = killCosts;
 	}
 
-	const std::vector<Note> & start(Note &newNote, const clap_output_events *eventsOut) {
-		tasks.clear();
-		if (notes.size() >= notes.capacity()) {
+	const Tasks & start(Note &newNote, const clap_output_events *eventsOut) {
+		clearTasks();
+		if (!validLaneWidth(laneWidth)) {
+			// We can't place it, so tell the host it's finished
+			newNote.voiceIndex = size_t(-1);
+			ignore(newNote, eventsOut);
+			return tasks;
+		}
+		if (states.size() >= polyphony()) {
 			// Kill an existing note
 			size_t killIndex = 0;
-			float killCost = 1e10f;
-			for (size_t i = 0; i < notes.size(); ++i) {
-				auto cost = noteKillCost(i, newNote.processFrom);
-				if (cost < killCost) {
-					killIndex = i;
-					killCost = cost;
+			if (voiceStealing == stealHeap && !voiceKillCosts) {
+				killIndex = voiceSlots[victimHeap.top()];
+			} else {
+				float killCost = 1e10f;
+				for (size_t i = 0; i < states.size(); ++i) {
+					auto cost = noteKillCost(i, newNote.processFrom);
+					if (cost < killCost) {
+						killIndex = i;
+						killCost = cost;
+					}
 				}
 			}
-			auto &killNote = notes[killIndex];
-			if (killNote.state != State::stateDown) {
+			if (states[killIndex] != State::stateDown) {
 				// Push this task even if it's zero length, unless it's not even started yet
-				killNote.state = stateKill;
-				killNote.processTo = newNote.processFrom;
-				tasks.push_back(killNote);
+				states[killIndex] = stateKill;
+				processTos[killIndex] = newNote.processFrom;
+				pushTask(killIndex, true); // the new note is about to take over this voice
+				setBit(killedBits, slotVoices[killIndex], true);
 			}
-			stop(killNote, eventsOut);
+			stopSlot(killIndex, eventsOut);
 		}
 
 		// We had at least one note left in capacity, so this is safe
-		newNote.voiceIndex = voiceIndexQueue.back();
+		newNote.voiceIndex = laneWidth ? laneVoice() : voiceIndexQueue.back();
 		if (voiceKillCosts) voiceKillCosts[newNote.voiceIndex] += 1e10f; // prefer not to kill this note again, since the custom cost won't get updated until later
-		voiceIndexQueue.pop_back();
-		notes.push_back(newNote);
+		takeFreeVoice(newNote.voiceIndex);
+		setBit(activeBits, newNote.voiceIndex, true);
+		
+		size_t slot = states.size();
+		states.push_back(newNote.state);
+		processFroms.push_back(newNote.processFrom);
+		processTos.push_back(newNote.processTo);
+		slotVoices.push_back(uint32_t(newNote.voiceIndex));
+		ages.push_back(newNote.age);
+		voiceSlots[newNote.voiceIndex] = slot;
+		storeNoteData(newNote);
+
+		index.add(newNote.voiceIndex, voiceData[newNote.voiceIndex]);
+		victimHeap.insert(newNote.voiceIndex, stealKey(slot, true));
 		return tasks;
 	}
 	
-	const std::vector<Note> & legato(Note &newNote, const Note &existingNote, const clap_output_events *eventsOut) {
-		tasks.clear();
-		for (auto &n : notes) {
-			if (n.match(existingNote)) {
-				// Process the note
-				addTask(n, newNote.processFrom);
-				sendNoteEnd(n, eventsOut); // release the old note ID
+	const Tasks & legato(Note &newNote, const Note &existingNote, const clap_output_events *eventsOut) {
+		clearTasks();
+		forEachMatchingVoice(existingNote.noteId, existingNote.port, existingNote.channel, existingNote.baseKey, false, [&](size_t voice){
+			size_t slot = voiceSlots[voice];
+			newNote.processFrom = newNote.processTo = std::max(splitTime(newNote.processFrom), processFroms[slot]);
+			// Process the note (with its old info, since we're about to replace it)
+			addTask(slot, newNote.processFrom, false, true);
+			sendNoteEnd(slot, eventsOut); // release the old note ID
 
-				auto voiceIndex = existingNote.voiceIndex;
-				n = newNote;
-				n.voiceIndex = newNote.voiceIndex = voiceIndex;
-				n.state = stateLegato;
-				if (legatoResetsAge) n.age = 0;
-				break;
-			}
-		}
+			index.remove(voice, voiceData[voice]);
+			newNote.voiceIndex = voice;
+			storeNoteData(newNote);
+			states[slot] = stateLegato;
+			processFroms[slot] = newNote.processFrom;
+			processTos[slot] = newNote.processTo;
+			ages[slot] = newNote.age;
+			if (legatoResetsAge) ages[slot] = 0;
+			index.add(voice, voiceData[voice]);
+			victimHeap.update(voice, stealKey(slot, legatoResetsAge));
+			return false;
+		});
 		return tasks;
 	}
 	
 	OptionalNote wouldRelease(const clap_event_header *event) const {
 		if (event->space_id != CLAP_CORE_EVENT_SPACE_ID) return {};
-		event = translateEvent(event);
+		TranslatedEvent translated;
+		event = translateEvent(event, translated);
 		if (event->type == CLAP_EVENT_NOTE_OFF || event->type == CLAP_EVENT_NOTE_CHOKE) {
 			auto &noteEvent = *(const clap_event_note *)event;
 			return {Note{size_t(-1), noteEvent, stateUp}}; // still includes any wildcards
@@ -251,30 +605,35 @@ struct NoteManager {
 		return {};
 	}
 
-	const std::vector<Note> & release(Note &releaseNote) {
+	const Tasks & release(Note &releaseNote) {
 		// If this is a note-end event (or we don't care) then use the timestamp we already have
 		return release(releaseNote, releaseNote.processFrom);
 	}
 
-	const std::vector<Note> & release(Note &releaseNote, uint32_t atBlockTime) {
-		tasks.clear();
-		for (auto &n : notes) {
-			if (n.match(releaseNote)) {
-				addTask(n, atBlockTime);
-				n.state = stateUp;
-				n.velocity = releaseNote.velocity;
-				if (releaseResetsAge) n.age = 0;
-				releaseNote.voiceIndex = n.voiceIndex; // let the caller know which note we just released
-				// Stop unless the note ID is a wildcard
-				if (releaseNote.noteId != -1) break;
-			}
-		}
+	const Tasks & release(Note &releaseNote, uint32_t atBlockTime) {
+		clearTasks();
+		// If the note ID isn't a wildcard, this only finds one note
+		atBlockTime = splitTime(atBlockTime);
+		forEachMatchingVoice(releaseNote.noteId, releaseNote.port, releaseNote.channel, releaseNote.baseKey, false, [&](size_t voice){
+			releaseVoice(voice, releaseNote.velocity, atBlockTime);
+			releaseNote.voiceIndex = voice; // let the caller know which note we just released
+			return true;
+		});
 		return tasks;
 	}
+	/* Releases the note a task refers to (if it's still active), e.g. for a note which should end itself.
+	
+	This is safe while iterating through the task list: the release is queued, and happens at the start of the next call which returns tasks (so `atBlockTime` shouldn't be later than that).  Its task comes first in that list. */
+	void release(const Task &task, uint32_t atBlockTime, double releaseVelocity=0) {
+		if (!isCurrent(task) || getBit(pendingReleaseBits, task.voiceIndex)) return;
+		setBit(pendingReleaseBits, task.voiceIndex, true);
+		pendingReleases.push_back({uint32_t(task.voiceIndex), task->noteId, splitTime(atBlockTime), releaseVelocity});
+	}
 
 	OptionalNoteMod wouldModNotes(const clap_event_header *event) const {
 		if (event->space_id != CLAP_CORE_EVENT_SPACE_ID) return {};
-		event = translateEvent(event);
+		TranslatedEvent translated;
+		event = translateEvent(event, translated);
 		if (event->type == CLAP_EVENT_NOTE_EXPRESSION) {
 			auto &exprEvent = *(const clap_event_note_expression *)event;
 			NoteMod noteMod{
@@ -290,26 +649,33 @@ struct NoteManager {
 		}
 		return {};
 	}
-	const std::vector<Note> & modNotes(const NoteMod &noteMod) {
+	const Tasks & modNotes(const NoteMod &noteMod) {
 		return modNotes(noteMod, noteMod.time);
 	}
-	const std::vector<Note> & modNotes(const NoteMod &noteMod, uint32_t atBlockTime) {
-		tasks.clear();
+	const Tasks & modNotes(const NoteMod &noteMod, uint32_t atBlockTime) {
+		clearTasks();
 		if (noteMod.noteId == -1 && noteMod.baseKey == -1 && noteMod.channel >= 0 && noteMod.channel < 16) {
 			// We're generally not tracking CC state, but if we're translating MPE to note expressions then we store them for the case when notes start after the CCs
 			channelNoteExpressions[noteMod.channel][noteMod.expression] = noteMod.value;
 		}
-		for (auto &n : notes) {
-			if (n.match(noteMod, true)) {
-				addTask(n, atBlockTime, true);
-				noteMod.applyTo(n);
-			}
+		if (noteExpressions == expressionsAsEvents) {
+			forEachMatchingVoice(noteMod.noteId, noteMod.port, noteMod.channel, noteMod.baseKey, true, [&](size_t voice){
+				addExpression(voice, noteMod, std::max(atBlockTime, processFroms[voiceSlots[voice]]));
+				return true;
+			});
+			return tasks;
 		}
+		atBlockTime = splitTime(atBlockTime);
+		forEachMatchingVoice(noteMod.noteId, noteMod.port, noteMod.channel, noteMod.baseKey, true, [&](size_t voice){
+			addTask(voiceSlots[voice], atBlockTime, true, true);
+			noteMod.applyTo(voiceData[voice]);
+			return true;
+		});
 		return tasks;
 	}
 
 	// Start or stop notes as appropriate
-	const std::vector<Note> & processEvent(const clap_event_header *event, const clap_output_events *eventsOut) {
+	const Tasks & processEvent(const clap_event_header *event, const clap_output_events *eventsOut) {
 		auto newNote = wouldStart(event);
 		if (newNote) return start(*newNote, eventsOut);
 		
@@ -319,55 +685,350 @@ struct NoteManager {
 		auto modNote = wouldModNotes(event);
 		if (modNote) return modNotes(*modNote);
 
-		tasks.clear();
+		clearTasks();
 		return tasks;
 	}
+
+	/* Translates MIDI into note/expression events (filling `translated` if needed), or returns the original event.
+
+	This doesn't store anything, so it's safe to call from multiple places at once. */
+	const clap_event_header * translateEvent(const clap_event_header *event, TranslatedEvent &translated) const {
+		if (event->type != CLAP_EVENT_MIDI) return event;
+		const clap_event_midi &midiEvent = *(const clap_event_midi *)event;
+
+		unsigned char eventType = midiEvent.data[0]&0xF0;
+		unsigned char channel = midiEvent.data[0]&0x0F;
+		if (eventType == 0x80 || eventType == 0x90) {
+			auto &noteEvent = translated.note;
+			noteEvent = {
+				.header=*event,
+				.note_id=-1,
+				.port_index=int16_t(midiEvent.port_index),
+				.channel=channel,
+				.key=int16_t(midiEvent.data[1]),
+				.velocity=midiEvent.data[2]/127.0
+			};
+			noteEvent.header.size = sizeof(noteEvent);
+			noteEvent.header.type = (eventType == 0x90 ? CLAP_EVENT_NOTE_ON : CLAP_EVENT_NOTE_OFF);
+			return &noteEvent.header;
+		} else if (eventType == 0xC0) {
+			return event; // we don't handle Program Change
+		}
+
+		auto &exprEvent = translated.noteExpression;
+		exprEvent = {
+			.header=*event,
+			.expression_id=-1,
+			.note_id=-1,
+			.port_index=int16_t(midiEvent.port_index),
+			.channel=channel,
+			.key=-1,
+			.value=0,
+		};
+		exprEvent.header.size = sizeof(exprEvent);
+		exprEvent.header.type = CLAP_EVENT_NOTE_EXPRESSION;
+
+		if (eventType == 0xA0) { // Polyphonic aftertouch -> note pressure
+			exprEvent.key = midiEvent.data[1];
+			exprEvent.expression_id = CLAP_NOTE_EXPRESSION_PRESSURE;
+			exprEvent.value = midiEvent.data[2]/127.0;
+		} else if (eventType == 0xB0) { // MIDI CC
+			auto cc = midiEvent.data[1]&0x7F;
+			exprEvent.expression_id = ccExpressions[cc];
+			if (exprEvent.expression_id == CLAP_NOTE_EXPRESSION_VOLUME) {
+				exprEvent.value = ccVolumes()[midiEvent.data[2]&0x7F];
+			} else {
+				exprEvent.value = midiEvent.data[2]/127.0;
+			}
+		} else if (eventType == 0xD0) { // Channel aftertouch -> note pressure
+			exprEvent.expression_id = CLAP_NOTE_EXPRESSION_PRESSURE;
+			exprEvent.value = midiEvent.data[1]/127.0;
+		} else if (eventType == 0xE0) { // Pitch wheel
+			exprEvent.expression_id = CLAP_NOTE_EXPRESSION_TUNING;
+			exprEvent.value = (midiEvent.data[1] + midiEvent.data[2]*128 - 0x2000)*pitchWheelRange/0x2000;
+		}
+		if (exprEvent.expression_id == -1) return event; // no translation
+		return &exprEvent.header;
+	}
 	
-	// This note has finished - we no longer want any other tasks about it, and its voice can be reassigned
-	void stop(const Note &noteToStop, const clap_output_events *eventsOut) {
-		for (auto &n : notes) {
-			if (n.match(noteToStop)) {
-				sendNoteEnd(n, eventsOut);
-				voiceIndexQueue.push_back(n.voiceIndex);
-
-				if (notes.size() <= 1) { // final note
-					notes.clear();
-				} else {
-					if (&n != &notes.back()) {
-						// Move the last note into this slot
-						n = notes.back();
-					}
-					notes.pop_back();
+	/* Reads all of a block's input events (translating MIDI) into a buffer, sorted by time, so they can be walked through as a plain array.
+
+	The buffer is reused for each block, and stays valid until the next call. */
+	const std::vector<InputEvent> & translateEvents(const clap_input_events *eventsIn) {
+		inputEvents.clear();
+		bool sorted = true;
+		uint32_t eventCount = eventsIn->size(eventsIn);
+		for (uint32_t i = 0; i < eventCount; ++i) {
+			auto *event = eventsIn->get(eventsIn, i);
+			inputEvents.emplace_back();
+			auto &input = inputEvents.back();
+			input.original = event;
+			input.translated = (translateEvent(event, input.translation) != event);
+			if (i > 0 && event->time < inputEvents[i - 1].original->time) sorted = false;
+		}
+		if (!sorted) {
+			// Hosts should send them in order, so this is just a fallback (insertion sort, which is stable and doesn't allocate)
+			for (size_t i = 1; i < inputEvents.size(); ++i) {
+				for (size_t j = i; j > 0 && inputEvents[j].original->time < inputEvents[j - 1].original->time; --j) {
+					std::swap(inputEvents[j], inputEvents[j - 1]);
 				}
-				return;
 			}
 		}
+		return inputEvents;
 	}
 
-	const std::vector<Note> & activeNotes() const {
-		return notes;
+	/* A whole block's tasks, grouped by voice and in order within each voice, so each voice can be rendered in a single pass over its segments.
+
+	The voices don't share anything, so they can be rendered in parallel - but `.stop()` isn't thread-safe, so collect those and call them afterwards. */
+	struct Schedule {
+		struct Segments {
+			const Task *first, *last;
+
+			const Task * begin() const {
+				return first;
+			}
+			const Task * end() const {
+				return last;
+			}
+			size_t size() const {
+				return last - first;
+			}
+		};
+		
+		// Voices with at least one segment this block
+		const Storage<uint32_t> & voices() const {
+			return activeVoices;
+		}
+		Segments forVoice(size_t voiceIndex) const {
+			return {segments.data() + voiceStarts[voiceIndex], segments.data() + voiceStarts[voiceIndex + 1]};
+		}
+		// All segments, grouped by voice
+		const std::vector<Task> & all() const {
+			return segments;
+		}
+	private:
+		friend struct BasicNoteManager;
+		
+		std::vector<Task> segments, pending;
+		std::vector<NoteData> data; // copies for the segments which need them
+		std::vector<uint32_t> pendingData; // index into `data`, or -1 to use the live per-voice info
+		Storage<uint32_t, fixedPolyphony + 1> voiceStarts;
+		Storage<uint32_t> activeVoices;
+	};
+
+	/* Handles all the events for a block, and returns every note's tasks up to `frames` as a schedule.  This makes the same calls (and so the same NOTE_END events) as using `processEvent()` for each event and then `processTo(frames)`.
+	
+	`eventFn(event)` is called for each (original, untranslated) input event after the notes have been updated for it. */
+	template<class EventFn>
+	const Schedule & scheduleBlock(const clap_input_events *eventsIn, uint32_t frames, const clap_output_events *eventsOut, EventFn &&eventFn) {
+		startBlock();
+		schedule.pending.clear();
+		schedule.pendingData.clear();
+		schedule.data.clear();
+		
+		for (auto &input : translateEvents(eventsIn)) {
+			// The notes might change again later in the block, so these tasks keep a copy
+			for (auto &task : processEvent(input.event(), eventsOut)) {
+				schedule.pending.push_back(task);
+				schedule.pendingData.push_back(uint32_t(schedule.data.size()));
+				schedule.data.push_back(*task.data);
+			}
+			eventFn(input.original);
+		}
+		for (auto &task : processTo(frames)) {
+			schedule.pending.push_back(task);
+			schedule.pendingData.push_back(uint32_t(-1));
+		}
+		
+		// Counting sort by voice, which keeps each voice's segments in order
+		auto &starts = schedule.voiceStarts;
+		starts.assign(polyphony() + 1, 0);
+		for (auto &task : schedule.pending) ++starts[task.voiceIndex + 1];
+		schedule.activeVoices.clear();
+		for (size_t v = 0; v < polyphony(); ++v) {
+			if (starts[v + 1] > 0) schedule.activeVoices.push_back(uint32_t(v));
+			starts[v + 1] += starts[v];
+		}
+		schedule.segments = schedule.pending;
+		for (size_t i = 0; i < schedule.pending.size(); ++i) {
+			auto &task = schedule.pending[i];
+			auto &segment = schedule.segments[starts[task.voiceIndex]++];
+			segment = task;
+			auto dataIndex = schedule.pendingData[i];
+			if (dataIndex != uint32_t(-1)) segment.data = &schedule.data[dataIndex];
+		}
+		// Shift the starts back (they were advanced while placing the segments)
+		for (size_t v = polyphony(); v > 0; --v) starts[v] = starts[v - 1];
+		starts[0] = 0;
+		return schedule;
+	}
+	const Schedule & scheduleBlock(const clap_input_events *eventsIn, uint32_t frames, const clap_output_events *eventsOut) {
+		return scheduleBlock(eventsIn, frames, eventsOut, [](const clap_event_header *){});
+	}
+	
+	// This note has finished - we no longer want any other tasks about it, and its voice can be reassigned
+	void stop(const Note &noteToStop, const clap_output_events *eventsOut) {
+		forEachMatchingVoice(noteToStop.noteId, noteToStop.port, noteToStop.channel, noteToStop.baseKey, false, [&](size_t voice){
+			stopSlot(voiceSlots[voice], eventsOut);
+			return false;
+		});
+	}
+	// Stops the note directly, without needing to look it up
+	void stop(const Task &task, const clap_output_events *eventsOut) {
+		if (isCurrent(task)) stopSlot(voiceSlots[task.voiceIndex], eventsOut);
+	}
+	
+	/* Calls `fn(note)` for each note matching an event (e.g. `clap_event_note_expression` or `clap_event_param_mod`), including wildcards.
+
+	This uses the lookup tables, so an exact note ID is constant-time, and wildcards only visit notes which could match. */
+	template<class ClapEvent, class Fn>
+	void forEachMatchEvent(const ClapEvent &clapEvent, Fn &&fn, bool wildcardsIncludeReleased=false) const {
+		forEachMatchingVoice(clapEvent.note_id, clapEvent.port_index, clapEvent.channel, clapEvent.key, wildcardsIncludeReleased, [&](size_t voice){
+			const Note note = noteAt(voiceSlots[voice]);
+			fn(note);
+			return true;
+		});
+	}
+
+	// Iterates through (copies of) the active notes
+	struct NoteIterator {
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Note;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Note *;
+		using reference = const Note &;
+
+		const BasicNoteManager *manager;
+		size_t slot;
+		
+		NoteIterator(const BasicNoteManager *manager, size_t slot) : manager(manager), slot(slot) {}
+
+		const Note & operator*() const {
+			note = manager->noteAt(slot);
+			return note;
+		}
+		const Note * operator->() const {
+			return &**this;
+		}
+		NoteIterator & operator++() {
+			++slot;
+			return *this;
+		}
+		bool operator==(const NoteIterator &other) const {
+			return slot == other.slot;
+		}
+		bool operator!=(const NoteIterator &other) const {
+			return slot != other.slot;
+		}
+	private:
+		mutable Note note;
+	};
+	NoteIterator begin() const {
+		return {this, 0};
+	}
+	NoteIterator end() const {
+		return {this, states.size()};
+	}
+	size_t size() const {
+		return states.size();
+	}
+	Note noteAt(size_t slot) const {
+		Note note;
+		size_t voice = slotVoices[slot];
+		note.voiceIndex = voice;
+		note.state = State(states[slot]);
+		note.processFrom = processFroms[slot];
+		note.processTo = processTos[slot];
+		note.age = ages[slot];
+
+		auto &data = voiceData[voice];
+		note.key = data.key;
+		note.velocity = data.velocity;
+		note.releaseVelocity = data.releaseVelocity;
+		note.volume = data.volume;
+		note.pan = data.pan;
+		note.mod = data.mod;
+		note.expression = data.expression;
+		note.brightness = data.brightness;
+		note.pressure = data.pressure;
+		note.port = data.port;
+		note.channel = data.channel;
+		note.noteId = data.noteId;
+		note.baseKey = data.baseKey;
+		return note;
+	}
+	Note operator[](size_t slot) const {
+		return noteAt(slot);
+	}
+
+	// The manager itself is a (read-only) list of notes
+	const BasicNoteManager & activeNotes() const {
+		return *this;
 	}
 	// Most of the time this isn't necessary
 	void sortByKey() {
-		std::sort(notes.begin(), notes.end(), [](const Note &a, const Note &b){
-			return a.key < b.key;
+		sortSlots([&](size_t a, size_t b){
+			return voiceData[slotVoices[a]].key < voiceData[slotVoices[b]].key;
 		});
 	}
 	template<class LessThan>
 	void sort(LessThan &&lessThan) {
-		std::sort(notes.begin(), notes.end(), lessThan);
+		sortSlots([&](size_t a, size_t b){
+			return lessThan(noteAt(a), noteAt(b));
+		});
 	}
 	
-	auto begin() const {
-		return notes.begin();
+	void swapVoices(size_t indexA, size_t indexB) {
+		if (indexA == indexB) return;
+		size_t voiceA = slotVoices[indexA], voiceB = slotVoices[indexB];
+		index.remove(voiceA, voiceData[voiceA]);
+		index.remove(voiceB, voiceData[voiceB]);
+		std::swap(voiceData[voiceA], voiceData[voiceB]);
+		std::swap(slotVoices[indexA], slotVoices[indexB]);
+		victimHeap.swapVoices(voiceA, voiceB);
+		voiceSlots[voiceB] = indexA;
+		voiceSlots[voiceA] = indexB;
+		std::swap(expressionHeads[voiceA], expressionHeads[voiceB]);
+		std::swap(expressionTails[voiceA], expressionTails[voiceB]);
+		swapBits(releasingBits, voiceA, voiceB);
+		swapBits(killedBits, voiceA, voiceB);
+		swapBits(pendingReleaseBits, voiceA, voiceB);
+		for (auto &pending : pendingReleases) {
+			if (pending.voice == voiceA) {
+				pending.voice = uint32_t(voiceB);
+			} else if (pending.voice == voiceB) {
+				pending.voice = uint32_t(voiceA);
+			}
+		}
+		index.add(voiceA, voiceData[voiceA]);
+		index.add(voiceB, voiceData[voiceB]);
+	}
+
+	// Voices with a note
+	const VoiceBits & activeVoices() const {
+		return activeBits;
+	}
+	// Voices whose note has been released
+	const VoiceBits & releasingVoices() const {
+		return releasingBits;
 	}
-	auto end() const {
-		return notes.end();
+	// Voices which had a note stolen (with a `stateKill` task) in this block - they might also have a new note
+	const VoiceBits & killedVoices() const {
+		return killedBits;
 	}
 	
-	void swapVoices(size_t indexA, size_t indexB) {
-		auto &noteA = notes[indexA], &noteB = notes[indexB];
-		std::swap(noteA.voiceIndex, noteB.voiceIndex);
+	// Number of `laneWidth` groups (or 64-voice groups if that's 0) covering all the voices
+	size_t laneGroups() const {
+		size_t width = laneWidth ? laneWidth : 64;
+		return (polyphony() + width - 1)/width;
+	}
+	// One group's bits from `activeVoices()`/`releasingVoices()`/`killedVoices()`
+	uint64_t laneBits(const VoiceBits &bits, size_t group) const {
+		if (!validLaneWidth(laneWidth)) return 0; // groups can't straddle two words
+		size_t width = laneWidth ? laneWidth : 64;
+		size_t bit = group*width;
+		uint64_t word = bits[bit/64] >> (bit%64);
+		return (width >= 64) ? word : (word&((uint64_t(1) << width) - 1));
 	}
 	
 private:
@@ -377,103 +1038,466 @@ private:
 		if (++internalNoteId >= 0x7FFFFFFF) internalNoteId = 2;
 	}
 
-	std::vector<Note> notes;
-	std::vector<Note> tasks;
-	std::vector<size_t> voiceIndexQueue;
+	// Hot fields (needed for every note, every block), in dense arrays by slot
+	Storage<State> states;
+	Storage<uint32_t> processFroms, processTos;
+	Storage<uint32_t> slotVoices;
+	Storage<size_t> ages; // since start/legato/up
+	// Everything else, indexed by voice
+	Storage<NoteData> voiceData;
+
+	Tasks tasks;
+	Storage<NoteData, fixedPolyphony*2> taskData; // copies for tasks whose note info changes straight afterwards (reserved, so never reallocates)
+	Schedule schedule;
+	Storage<size_t> voiceIndexQueue, voiceQueuePositions;
+	Storage<size_t> voiceSlots; // voice index -> slot
+	VoiceBits activeBits, releasingBits, killedBits;
+
+	static bool getBit(const VoiceBits &bits, size_t voice) {
+		return (bits[voice/64] >> (voice%64))&1;
+	}
+	static void setBit(VoiceBits &bits, size_t voice, bool value) {
+		uint64_t bit = uint64_t(1) << (voice%64);
+		if (value) {
+			bits[voice/64] |= bit;
+		} else {
+			bits[voice/64] &= ~bit;
+		}
+	}
+	static void swapBits(VoiceBits &bits, size_t voiceA, size_t voiceB) {
+		bool a = getBit(bits, voiceA);
+		setBit(bits, voiceA, getBit(bits, voiceB));
+		setBit(bits, voiceB, a);
+	}
+	static bool validLaneWidth(size_t width) {
+		return width <= 64 && !(width&(width - 1));
+	}
 
-	void addTask(Note &n, uint32_t processTo, bool noStateChange=false) {
+	void pushFreeVoice(size_t voice) {
+		voiceQueuePositions[voice] = voiceIndexQueue.size();
+		voiceIndexQueue.push_back(voice);
+	}
+	// Removes a voice from the free queue (in constant time, by moving the last one into its place)
+	void takeFreeVoice(size_t voice) {
+		size_t pos = voiceQueuePositions[voice];
+		size_t last = voiceIndexQueue.back();
+		voiceIndexQueue[pos] = last;
+		voiceQueuePositions[last] = pos;
+		voiceIndexQueue.pop_back();
+	}
+	// Free voice in the fullest lane group which has space
+	size_t laneVoice() const {
+		size_t width = laneWidth, groups = laneGroups();
+		size_t bestGroup = 0, bestCount = 0;
+		uint64_t bestFree = 0;
+		for (size_t g = 0; g < groups; ++g) {
+			uint64_t used = laneBits(activeBits, g);
+			size_t lanes = std::min(width, polyphony() - g*width);
+			uint64_t lanesMask = (lanes >= 64) ? ~uint64_t(0) : ((uint64_t(1) << lanes) - 1);
+			uint64_t free = ~used&lanesMask;
+			if (!free) continue;
+			size_t count = _impl::popCount64(used);
+			if (!bestFree || count > bestCount) {
+				bestGroup = g;
+				bestCount = count;
+				bestFree = free;
+				if (count + 1 == lanes) break; // can't do better than filling a group
+			}
+		}
+		return bestGroup*width + _impl::lowestBit64(bestFree);
+	}
+	Storage<uint32_t> sortOrder;
+
+	void clearSlots() {
+		states.clear();
+		processFroms.clear();
+		processTos.clear();
+		slotVoices.clear();
+		ages.clear();
+	}
+	void moveSlot(size_t from, size_t to) {
+		states[to] = states[from];
+		processFroms[to] = processFroms[from];
+		processTos[to] = processTos[from];
+		slotVoices[to] = slotVoices[from];
+		ages[to] = ages[from];
+		voiceSlots[slotVoices[to]] = to;
+	}
+	void popSlot() {
+		states.pop_back();
+		processFroms.pop_back();
+		processTos.pop_back();
+		slotVoices.pop_back();
+		ages.pop_back();
+	}
+	void storeNoteData(const Note &note) {
+		auto &data = voiceData[note.voiceIndex];
+		data.key = note.key;
+		data.velocity = note.velocity;
+		data.releaseVelocity = note.releaseVelocity;
+		data.volume = float(note.volume);
+		data.pan = float(note.pan);
+		data.mod = float(note.mod);
+		data.expression = float(note.expression);
+		data.brightness = float(note.brightness);
+		data.pressure = float(note.pressure);
+		data.noteId = note.noteId;
+		data.port = note.port;
+		data.channel = note.channel;
+		data.baseKey = note.baseKey;
+	}
+	
+	void stopSlot(size_t slot, const clap_output_events *eventsOut) {
+		size_t voice = slotVoices[slot];
+		expressionHeads[voice] = expressionTails[voice] = noExpression; // drop any remaining changes
+		sendNoteEnd(slot, eventsOut);
+		pushFreeVoice(voice);
+		setBit(activeBits, voice, false);
+		setBit(releasingBits, voice, false);
+		index.remove(voice, voiceData[voice]);
+		victimHeap.remove(voice);
+
+		// Move the last note into this slot
+		size_t last = states.size() - 1;
+		if (slot != last) moveSlot(last, slot);
+		popSlot();
+	}
+
+	// Sorts the hot arrays (using a permutation, since they're separate)
+	template<class LessThan>
+	void sortSlots(LessThan &&lessThan) {
+		sortOrder.clear();
+		for (size_t i = 0; i < states.size(); ++i) sortOrder.push_back(uint32_t(i));
+		std::sort(sortOrder.begin(), sortOrder.end(), lessThan);
+		// Apply the permutation in-place, one cycle at a time
+		for (size_t i = 0; i < sortOrder.size(); ++i) {
+			if (sortOrder[i] == i) continue;
+			State state = states[i];
+			uint32_t from = processFroms[i], to = processTos[i], voice = slotVoices[i];
+			size_t age = ages[i];
+			size_t j = i;
+			while (sortOrder[j] != i) {
+				size_t k = sortOrder[j];
+				moveSlot(k, j);
+				sortOrder[j] = uint32_t(j);
+				j = k;
+			}
+			states[j] = state;
+			processFroms[j] = from;
+			processTos[j] = to;
+			slotVoices[j] = voice;
+			ages[j] = age;
+			voiceSlots[voice] = j;
+			sortOrder[j] = uint32_t(j);
+		}
+	}
+
+	/* Secondary lookups for matching events to notes, all indexed by voice (which is stable while the note's active, unlike its slot).
+	
+	Note IDs are in an open-addressed hash table.  Each voice is also in three intrusive linked lists: by (channel, key), by channel and by key, so a wildcard event only has to visit the notes in the most specific list.  Notes with out-of-range channel/key go in a separate list which is always checked. */
+	struct NoteIndex {
+		static constexpr uint32_t none = uint32_t(-1);
+		static constexpr size_t channels = 16, keys = 128;
+		enum {listExact, listChannel, listKey, listCount};
+		
+		void resize(size_t polyphony) {
+			links.resize(polyphony);
+			size_t tableSize = _impl::noteIdTableSize(polyphony);
+			idTable.resize(tableSize);
+			idMask = tableSize - 1;
+			clear();
+		}
+		
+		void clear() {
+			exactHeads.fill(none);
+			channelHeads.fill(none);
+			keyHeads.fill(none);
+			otherHead = none;
+			for (auto &entry : idTable) entry = {-1, none};
+		}
+		
+		void add(size_t voiceIndex, const NoteData &n) {
+			uint32_t voice = uint32_t(voiceIndex);
+			if (inRange(n.channel, n.baseKey)) {
+				link(exactHeads[n.channel*keys + n.baseKey], listExact, voice);
+				link(channelHeads[n.channel], listChannel, voice);
+				link(keyHeads[n.baseKey], listKey, voice);
+			} else {
+				link(otherHead, listExact, voice);
+			}
+			// Linear probing
+			size_t i = idSlot(n.noteId);
+			while (idTable[i].voice != none) i = (i + 1)&idMask;
+			idTable[i] = {n.noteId, voice};
+		}
+
+		void remove(size_t voiceIndex, const NoteData &n) {
+			uint32_t voice = uint32_t(voiceIndex);
+			if (inRange(n.channel, n.baseKey)) {
+				unlink(exactHeads[n.channel*keys + n.baseKey], listExact, voice);
+				unlink(channelHeads[n.channel], listChannel, voice);
+				unlink(keyHeads[n.baseKey], listKey, voice);
+			} else {
+				unlink(otherHead, listExact, voice);
+			}
+
+			size_t i = idSlot(n.noteId);
+			while (idTable[i].voice != voice) {
+				if (idTable[i].voice == none) return;
+				i = (i + 1)&idMask;
+			}
+			// Backward-shift deletion, so we don't need tombstones
+			size_t j = i;
+			while (true) {
+				j = (j + 1)&idMask;
+				if (idTable[j].voice == none) break;
+				size_t ideal = idSlot(idTable[j].noteId);
+				if (((j - ideal)&idMask) >= ((j - i)&idMask)) {
+					idTable[i] = idTable[j];
+					i = j;
+				}
+			}
+			idTable[i] = {-1, none};
+		}
+		
+		uint32_t findId(int32_t noteId) const {
+			size_t i = idSlot(noteId);
+			while (idTable[i].voice != none) {
+				if (idTable[i].noteId == noteId) return idTable[i].voice;
+				i = (i + 1)&idMask;
+			}
+			return none;
+		}
+
+		// Visits voices in a list, until `fn(voice)` returns `false`
+		template<class Fn>
+		bool forEachIn(uint32_t voice, size_t list, Fn &fn) const {
+			while (voice != none) {
+				uint32_t next = links[voice][list].next; // in case `fn()` removes this voice
+				if (!fn(size_t(voice))) return false;
+				voice = next;
+			}
+			return true;
+		}
+		uint32_t exactHead(int16_t channel, int16_t key) const {
+			return exactHeads[channel*keys + key];
+		}
+
+		std::array<uint32_t, channels*keys> exactHeads;
+		std::array<uint32_t, channels> channelHeads;
+		std::array<uint32_t, keys> keyHeads;
+		uint32_t otherHead = none;
+
+		static bool inRange(int16_t channel, int16_t key) {
+			return channel >= 0 && channel < int16_t(channels) && key >= 0 && key < int16_t(keys);
+		}
+	private:
+		struct Link {
+			uint32_t prev, next;
+		};
+		Storage<std::array<Link, listCount>> links;
+		struct IdEntry {
+			int32_t noteId;
+			uint32_t voice;
+		};
+		Storage<IdEntry, _impl::noteIdTableSize(fixedPolyphony)> idTable;
+		size_t idMask = 0;
+		
+		size_t idSlot(int32_t noteId) const {
+			return size_t((uint64_t(uint32_t(noteId))*0x9E3779B97F4A7C15ull) >> 32)&idMask;
+		}
+
+		void link(uint32_t &head, size_t list, uint32_t voice) {
+			auto &l = links[voice][list];
+			l.prev = none;
+			l.next = head;
+			if (head != none) links[head][list].prev = voice;
+			head = voice;
+		}
+		void unlink(uint32_t &head, size_t list, uint32_t voice) {
+			auto &l = links[voice][list];
+			if (l.prev != none) {
+				links[l.prev][list].next = l.next;
+			} else {
+				head = l.next;
+			}
+			if (l.next != none) links[l.next][list].prev = l.prev;
+		}
+	};
+	NoteIndex index;
+	
+	// Calls `fn(voiceIndex)` for each matching note, until it returns `false`.  Negative port/channel/key are wildcards, but a note ID (other than -1) always matches exactly.
+	template<class Fn>
+	void forEachMatchingVoice(int32_t noteId, int16_t port, int16_t channel, int16_t key, bool wildcardsIncludeReleased, Fn &&fn) const {
+		if (noteId != -1) {
+			auto voice = index.findId(noteId);
+			if (voice != index.none) fn(size_t(voice));
+			return;
+		}
+		auto visit = [&](size_t voice){
+			auto &n = voiceData[voice];
+			if (!wildcardsIncludeReleased && released(states[voiceSlots[voice]])) return true;
+			if (port >= 0 && port != n.port) return true;
+			if (channel >= 0 && channel != n.channel) return true;
+			if (key >= 0 && key != n.baseKey) return true;
+			return fn(voice);
+		};
+		if (channel < 0 && key < 0) {
+			// Full wildcard - backwards, in case `fn()` stops the current note (which moves the last one)
+			for (size_t i = slotVoices.size(); i > 0; --i) {
+				if (!visit(slotVoices[i - 1])) return;
+			}
+			return;
+		}
+		if (channel < 0) {
+			if (key < int16_t(index.keys) && !index.forEachIn(index.keyHeads[key], index.listKey, visit)) return;
+		} else if (key < 0) {
+			if (channel < int16_t(index.channels) && !index.forEachIn(index.channelHeads[channel], index.listChannel, visit)) return;
+		} else if (index.inRange(channel, key)) {
+			if (!index.forEachIn(index.exactHead(channel, key), index.listExact, visit)) return;
+		}
+		index.forEachIn(index.otherHead, index.listExact, visit);
+	}
+
+	static bool released(State state) {
+		return state == stateUp || state == stateRelease || state == stateKill;
+	}
+
+	uint32_t splitTime(uint32_t time) const {
+		return (splitGranularity > 1) ? time - time%splitGranularity : time;
+	}
+
+	void clearTasks() {
+		tasks.clear();
+		taskData.clear();
+		for (auto &pending : pendingReleases) {
+			setBit(pendingReleaseBits, pending.voice, false);
+			size_t slot = voiceSlots[pending.voice];
+			bool current = slot < states.size() && slotVoices[slot] == pending.voice && voiceData[pending.voice].noteId == pending.noteId;
+			if (current && !released(states[slot])) releaseVoice(pending.voice, pending.velocity, pending.time);
+		}
+		pendingReleases.clear();
+	}
+	// From `release(task)`, at most one per voice
+	struct PendingRelease {
+		uint32_t voice;
+		int32_t noteId;
+		uint32_t time;
+		double velocity;
+	};
+	Storage<PendingRelease> pendingReleases;
+	VoiceBits pendingReleaseBits;
+	// Adds a task for the slot's current range.  If the note's info is about to change, `copyData` keeps the old info for the task.
+	void pushTask(size_t slot, bool copyData=false) {
+		size_t voice = slotVoices[slot];
+		uint32_t processTo = processTos[slot];
+		// Changes before the end of this task belong to it
+		uint32_t first = expressionHeads[voice], last = noExpression;
+		for (uint32_t e = first; e != noExpression && expressionEvents[e].noteMod.time < processTo; e = expressionEvents[e].next) {
+			last = e;
+		}
+		if (last == noExpression) first = noExpression;
+
+		const NoteData *data = &voiceData[voice];
+		if (copyData || first != noExpression) {
+			size_t dataCount = taskData.size();
+			taskData.push_back(*data);
+			if (taskData.size() > dataCount) data = &taskData.back(); // if the copy was dropped, use the live info instead
+		}
+		tasks.push_back({voice, states[slot], processFroms[slot], processTo, data, ages[slot], first});
+
+		if (first != noExpression) {
+			// Update the stored note info, and split the list
+			for (uint32_t e = first; e != noExpression; e = expressionEvents[e].next) {
+				expressionEvents[e].noteMod.applyTo(voiceData[voice]);
+				if (e == last) break;
+			}
+			expressionHeads[voice] = expressionEvents[last].next;
+			if (expressionHeads[voice] == noExpression) expressionTails[voice] = noExpression;
+			expressionEvents[last].next = noExpression;
+		}
+	}
+	void addTask(size_t slot, uint32_t processTo, bool noStateChange=false, bool copyData=false) {
+		processTo = std::max(processTo, processFroms[slot]); // only matters with `splitGranularity`, where a note might start after the rounded time
 		// Skip zero-length tasks for non-event states, or if we know that the event state isn't about to be overwritten
-		if (n.processFrom >= processTo && (noStateChange || n.state == stateContinue || n.state == stateRelease)) return;
-		n.processTo = processTo;
-		tasks.push_back(n);
-		n.age += (processTo - n.processFrom);
-		n.processFrom = processTo;
+		auto state = states[slot];
+		if (processFroms[slot] >= processTo && (noStateChange || state == stateContinue || state == stateRelease)) return;
+		processTos[slot] = processTo;
+		pushTask(slot, copyData);
+		ages[slot] += (processTo - processFroms[slot]);
+		processFroms[slot] = processTo;
+	}
+
+	// Whether the task's note is still the one using that voice (e.g. not stolen)
+	bool isCurrent(const Task &task) const {
+		size_t slot = voiceSlots[task.voiceIndex];
+		return slot < states.size() && slotVoices[slot] == task.voiceIndex && voiceData[task.voiceIndex].noteId == task->noteId;
+	}
+	void releaseVoice(size_t voice, double releaseVelocity, uint32_t atBlockTime) {
+		size_t slot = voiceSlots[voice];
+		addTask(slot, atBlockTime);
+		states[slot] = stateUp;
+		setBit(releasingBits, voice, true);
+		voiceData[voice].releaseVelocity = releaseVelocity;
+		if (releaseResetsAge) ages[slot] = 0;
+		victimHeap.update(voice, stealKey(slot, releaseResetsAge));
 	}
 	
-	void sendNoteEnd(const Note &n, const clap_output_events *eventsOut) {
-		if (n.noteId >= 0) {
+	void sendNoteEnd(size_t slot, const clap_output_events *eventsOut) {
+		auto &n = voiceData[slotVoices[slot]];
+		sendNoteEnd(n.noteId, n.port, n.baseKey, processFroms[slot], eventsOut);
+	}
+	void sendNoteEnd(int32_t noteId, int16_t port, int16_t baseKey, uint32_t time, const clap_output_events *eventsOut) {
+		if (noteId >= 0) {
 			// Let the host know the note isn't available for modulation any more
 			clap_event_note stopEvent{
 				.header={
 					.size=sizeof(clap_event_note),
-					.time=n.processFrom,
+					.time=time,
 					.space_id=CLAP_CORE_EVENT_SPACE_ID,
 					.type=CLAP_EVENT_NOTE_END,
 					.flags=CLAP_EVENT_DONT_RECORD
 				},
-				.note_id=n.noteId,
-				.port_index=n.port,
-				.channel=n.port,
-				.key=n.baseKey,
+				.note_id=noteId,
+				.port_index=port,
+				.channel=port,
+				.key=baseKey,
 				.velocity=0
 			};
 			eventsOut->try_push(eventsOut, &stopEvent.header);
 		}
 	}
 	
-	union {
-		mutable clap_event_note noteEvent;
-		mutable clap_event_note_expression noteExprEvent;
-	};
+	std::vector<InputEvent> inputEvents;
 
-	const clap_event_header * translateEvent(const clap_event_header *event) const {
-		if (event->type != CLAP_EVENT_MIDI) return event;
-		const clap_event_midi &midiEvent = *(const clap_event_midi *)event;
-
-		unsigned char eventType = midiEvent.data[0]&0xF0;
-		unsigned char channel = midiEvent.data[0]&0x0F;
-		if (eventType == 0x80 || eventType == 0x90) {
-			noteEvent = {
-				.header=*event,
-				.note_id=-1,
-				.port_index=int16_t(midiEvent.port_index),
-				.channel=channel,
-				.key=int16_t(midiEvent.data[1]),
-				.velocity=midiEvent.data[2]/127.0
-			};
-			noteEvent.header.size = sizeof(noteEvent);
-			noteEvent.header.type = (eventType == 0x90 ? CLAP_EVENT_NOTE_ON : CLAP_EVENT_NOTE_OFF);
-			return &noteEvent.header;
-		} else if (eventType == 0xC0) {
-			return event; // we don't handle Program Change
+	// Note-expression changes (with `expressionsAsEvents`), as a linked list for each voice
+	static constexpr uint32_t noExpression = uint32_t(-1);
+	struct ExpressionEvent {
+		NoteMod noteMod;
+		uint32_t next;
+	};
+	std::vector<ExpressionEvent> expressionEvents;
+	Storage<uint32_t> expressionHeads, expressionTails; // changes not yet given to a task, by voice
+	void addExpression(size_t voice, const NoteMod &noteMod, uint32_t time) {
+		uint32_t e = uint32_t(expressionEvents.size());
+		expressionEvents.push_back({noteMod, noExpression});
+		expressionEvents.back().noteMod.time = time;
+		if (expressionTails[voice] == noExpression) {
+			expressionHeads[voice] = e;
 		} else {
-			noteExprEvent = {
-				.header=*event,
-				.expression_id=-1,
-				.note_id=-1,
-				.port_index=int16_t(midiEvent.port_index),
-				.channel=channel,
-				.key=-1,
-				.value=0,
-			};
-			noteExprEvent.header.size = sizeof(noteExprEvent);
-			noteExprEvent.header.type = CLAP_EVENT_NOTE_EXPRESSION;
-
-			if (eventType == 0xA0) { // Polyphonic aftertouch -> note pressure
-				noteExprEvent.key = midiEvent.data[1];
-				noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_PRESSURE;
-				noteExprEvent.value = midiEvent.data[2]/127.0;
-			} else if (eventType == 0xB0) { // MIDI CC
-				auto cc = midiEvent.data[1];
-				noteExprEvent.value = midiEvent.data[2]/127.0;
-				if (cc == 1) noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_VIBRATO;
-				if (cc == 4) noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_BRIGHTNESS; // foot pedal, why not
-				if (cc == 10) noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_PAN;
-				if (cc == 11) noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_EXPRESSION;
-				if (cc == 7) {
-					noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_VOLUME;
-					noteExprEvent.value = std::pow(midiEvent.data[2]/100.0, 5.8); // volume 0-4, with CC=100 -> volume=1
-				}
-			} else if (eventType == 0xD0) { // Channel aftertouch -> note pressure
-				noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_PRESSURE;
-				noteExprEvent.value = midiEvent.data[1]/127.0;
-			} else if (eventType == 0xE0) { // Pitch wheel
-				noteExprEvent.expression_id = CLAP_NOTE_EXPRESSION_TUNING;
-				noteExprEvent.value = (midiEvent.data[1] + midiEvent.data[2]*128 - 0x2000)*pitchWheelRange/0x2000;
-			}
-			if (noteExprEvent.expression_id == -1) return event; // no translation
-			return &noteExprEvent.header;
+			expressionEvents[expressionTails[voice]].next = e;
 		}
+		expressionTails[voice] = e;
+	}
+
+	// CC value -> volume, where CC=100 is 1 (so the maximum is about 4)
+	static const std::array<double, 128> & ccVolumes() {
+		static const std::array<double, 128> table = []{
+			std::array<double, 128> t;
+			for (size_t i = 0; i < 128; ++i) t[i] = std::pow(i/100.0, 5.8);
+			return t;
+		}();
+		return table;
 	}
 
 	// Default note expressions taken from MPE-translated CCs
@@ -489,12 +1513,126 @@ private:
 		note.pressure = channelNoteExpressions[note.channel][CLAP_NOTE_EXPRESSION_PRESSURE];
 	}
 
+	/* Indexed min-heap of voices, for picking which note to steal.
+	
+	The cost matches `noteKillCost()`: ranked by state (kill, then release, up, continue, legato, down), then the oldest first.  Notes all age at the same rate, so instead of the actual age (which changes every sample) we use a counter which increments every time a note's age is reset. */
+	struct StealKey {
+		float cost;
+		uint64_t order;
+
+		bool operator<(const StealKey &other) const {
+			return cost < other.cost || (cost == other.cost && order < other.order);
+		}
+	};
+	struct StealHeap {
+		static constexpr uint32_t none = uint32_t(-1);
+		
+		void resize(size_t polyphony) {
+			heap.reserve(polyphony);
+			positions.resize(polyphony);
+			keys.resize(polyphony);
+			clear();
+		}
+		void clear() {
+			heap.clear();
+			for (auto &p : positions) p = none;
+		}
+		
+		const StealKey & key(size_t voice) const {
+			return keys[voice];
+		}
+		size_t top() const {
+			return heap[0];
+		}
+		
+		void insert(size_t voice, StealKey k) {
+			keys[voice] = k;
+			positions[voice] = uint32_t(heap.size());
+			heap.push_back(uint32_t(voice));
+			siftUp(heap.size() - 1);
+		}
+		void update(size_t voice, StealKey k) {
+			keys[voice] = k;
+			size_t i = positions[voice];
+			if (i == none) return;
+			siftUp(i);
+			siftDown(positions[voice]);
+		}
+		void remove(size_t voice) {
+			size_t i = positions[voice];
+			if (i == none) return;
+			positions[voice] = none;
+			uint32_t last = heap.back();
+			heap.pop_back();
+			if (i < heap.size()) {
+				heap[i] = last;
+				positions[last] = uint32_t(i);
+				siftUp(i);
+				siftDown(positions[last]);
+			}
+		}
+		// The notes swapped voices, so their keys and heap entries swap too
+		void swapVoices(size_t voiceA, size_t voiceB) {
+			std::swap(keys[voiceA], keys[voiceB]);
+			std::swap(positions[voiceA], positions[voiceB]);
+			if (positions[voiceA] != none) heap[positions[voiceA]] = uint32_t(voiceA);
+			if (positions[voiceB] != none) heap[positions[voiceB]] = uint32_t(voiceB);
+		}
+	private:
+		Storage<uint32_t> heap; // voice indices
+		Storage<uint32_t> positions; // voice -> heap position
+		Storage<StealKey> keys; // indexed by voice
+		
+		void place(size_t i, uint32_t voice) {
+			heap[i] = voice;
+			positions[voice] = uint32_t(i);
+		}
+		void siftUp(size_t i) {
+			uint32_t voice = heap[i];
+			while (i > 0) {
+				size_t parent = (i - 1)/2;
+				if (!(keys[voice] < keys[heap[parent]])) break;
+				place(i, heap[parent]);
+				i = parent;
+			}
+			place(i, voice);
+		}
+		void siftDown(size_t i) {
+			uint32_t voice = heap[i];
+			while (true) {
+				size_t child = i*2 + 1;
+				if (child >= heap.size()) break;
+				if (child + 1 < heap.size() && keys[heap[child + 1]] < keys[heap[child]]) ++child;
+				if (!(keys[heap[child]] < keys[voice])) break;
+				place(i, heap[child]);
+				i = child;
+			}
+			place(i, voice);
+		}
+	};
+	StealHeap victimHeap;
+	uint64_t stealOrder = 0;
+	
+	StealKey stealKey(size_t slot, bool ageWasReset) {
+		size_t voice = slotVoices[slot];
+		return {float(10 - int(states[slot])), ageWasReset ? stealOrder++ : victimHeap.key(voice).order};
+	}
+
 	float *voiceKillCosts = nullptr;
-	float noteKillCost(size_t noteIndex, size_t blockIndex) {
-		auto &note = notes[noteIndex];
-		if (voiceKillCosts) return voiceKillCosts[note.voiceIndex];
-		return 1.0f/(note.ageAt(blockIndex) + 1) + 10 - (int)note.state;
+	float noteKillCost(size_t slot, size_t blockIndex) {
+		if (voiceKillCosts) return voiceKillCosts[slotVoices[slot]];
+		auto ageAt = ages[slot] + (blockIndex - processFroms[slot]);
+		return 1.0f/(ageAt + 1) + 10 - (int)states[slot];
 	}
 };
 
+using NoteManager = BasicNoteManager<>;
+
+template<size_t polyphony>
+struct FixedNoteManager : public BasicNoteManager<polyphony> {
+	static_assert(polyphony > 0, "use NoteManager for runtime polyphony");
+
+	FixedNoteManager(double pitchWheelRange=2) : BasicNoteManager<polyphony>(polyphony, pitchWheelRange) {}
+};
+
 }} // namespace
@@ -5,22 +5,412 @@
 #include "clap/events.h"
 #include "clap/ext/params.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <initializer_list>
+#include <vector>
 
 namespace signalsmith { namespace clap {
 
+/** Turns timestamped value changes into sample-accurate (or sub-block) ramps.
+
+Changes are queued with `.addEvent()` during the block, and `.process()` then fills an aligned buffer.  If the value isn't moving, `.process()` returns `false` without touching the buffer, so DSP code can use the constant `.value()` instead.
+
+Smoothing is disabled (and nothing is allocated) unless `.rampMs` is positive when `.configure()` is called.
+*/
+struct ParamRamp {
+	enum Curve {curveLinear, curveOnePole};
+	Curve curve = curveLinear;
+	double rampMs = 0; // linear: exact ramp time, one-pole: time to get within -60dB
+	uint32_t granularity = 1; // one output per sample, or per sub-block of this length
+
+	static constexpr size_t alignBytes = 64;
+	static constexpr size_t maxEvents = 16; // beyond this, a new event in the same block replaces the one before it
+
+	void configure(double sampleRate, uint32_t maxFrames) {
+		granularity = std::max<uint32_t>(granularity, 1);
+		storage.clear();
+		if (rampMs <= 0) return;
+		double rampSamples = rampMs*0.001*sampleRate;
+		rampSteps = std::max<uint32_t>(1, uint32_t(std::round(rampSamples/granularity)));
+		onePoleCoeff = 1 - std::exp(std::log(0.001)/rampSteps);
+		
+		size_t alignFloats = alignBytes/sizeof(float);
+		storage.resize(maxFrames/granularity + 1 + alignFloats);
+		auto address = reinterpret_cast<std::uintptr_t>(storage.data());
+		alignOffset = ((alignBytes - address%alignBytes)%alignBytes)/sizeof(float);
+		reset(target);
+	}
+	
+	bool enabled() const {
+		return !storage.empty();
+	}
+	
+	void reset(double v) {
+		current = target = v;
+		remaining = 0;
+		eventCount = 0;
+	}
+
+	// Events can be added in any order, and are kept sorted by time (after existing ones at the same time)
+	void addEvent(uint32_t time, double v) {
+		size_t i = eventCount;
+		while (i > 0 && events[i - 1].time > time) --i;
+		if (eventCount == maxEvents) {
+			events[i ? i - 1 : 0] = {time, v};
+			return;
+		}
+		for (size_t j = eventCount; j > i; --j) events[j] = events[j - 1];
+		events[i] = {time, v};
+		++eventCount;
+	}
+	
+	// Fills `.data()` with `outputSize(frames)` values, or returns `false` if the value is constant for this block
+	bool process(uint32_t frames) {
+		if (!eventCount && !remaining) return false;
+		uint32_t length = outputSize(frames);
+		float *out = data();
+		uint32_t i = 0;
+		for (size_t e = 0; e < eventCount; ++e) {
+			// Already in time order, from `.addEvent()`
+			uint32_t eventIndex = std::max(i, std::min(events[e].time/granularity, length));
+			fill(out, i, eventIndex);
+			i = eventIndex;
+			setTarget(events[e].value);
+		}
+		eventCount = 0;
+		fill(out, i, length);
+		return true;
+	}
+	
+	uint32_t outputSize(uint32_t frames) const {
+		return (frames + granularity - 1)/granularity;
+	}
+
+	float * data() {
+		return storage.data() + alignOffset;
+	}
+	const float * data() const {
+		return storage.data() + alignOffset;
+	}
+	
+	// The value at the end of the most recent `.process()`
+	double value() const {
+		return current;
+	}
+	bool moving() const {
+		return remaining;
+	}
+	// The value we're heading towards, including any queued events
+	double targetValue() const {
+		return eventCount ? events[eventCount - 1].value : target;
+	}
+
+private:
+	std::vector<float> storage;
+	size_t alignOffset = 0;
+
+	struct Event {
+		uint32_t time;
+		double value;
+	};
+	std::array<Event, maxEvents> events;
+	size_t eventCount = 0;
+
+	uint32_t rampSteps = 1;
+	double onePoleCoeff = 1;
+	double current = 0, target = 0, step = 0;
+	uint32_t remaining = 0; // linear: steps left, one-pole: non-zero until settled
+	double settleDistance = 0;
+
+	void setTarget(double v) {
+		target = v;
+		if (current == target) {
+			remaining = 0;
+		} else if (curve == curveLinear) {
+			step = (target - current)/rampSteps;
+			remaining = rampSteps;
+		} else {
+			settleDistance = std::abs(target - current)*1e-4; // -80dB of the jump
+			remaining = 1;
+		}
+	}
+	
+	void fill(float *out, uint32_t i, uint32_t end) {
+		if (curve == curveLinear) {
+			uint32_t rampEnd = std::min(end, i + remaining);
+			double start = current;
+			for (uint32_t j = i; j < rampEnd; ++j) {
+				out[j] = float(start + step*(j + 1 - i));
+			}
+			remaining -= rampEnd - i;
+			current = remaining ? start + step*(rampEnd - i) : target;
+			i = rampEnd;
+		} else {
+			for (; i < end && remaining; ++i) {
+				current += (target - current)*onePoleCoeff;
+				if (std::abs(target - current) < settleDistance) {
+					current = target;
+					remaining = 0;
+				}
+				out[i] = float(current);
+			}
+		}
+		std::fill(out + i, out + end, float(current));
+	}
+};
+
+/** Pending host events for a group of 64 parameters, one bit per parameter.
+
+`any` is set after the specific bits, so the audio thread can skip the whole group with a single load.  `info` is for the main thread (parameter info or text changes), and doesn't touch `any`.
+*/
+struct ParamDirtyBits {
+	std::atomic<uint64_t> any{0}, gestureStart{0}, value{0}, gestureEnd{0};
+	std::atomic<uint64_t> info{0};
+};
+
+/** Describes how a parameter value is shown as text (and parsed back), writing straight into the host's buffer without allocating.
+
+The value is mapped to a display value (e.g. `2^value` for a log-frequency parameter), then printed with a fixed precision and unit suffix.  These are cheap to copy, so the factory functions below can be shared between parameters.
+*/
+struct ParamFormat {
+	enum Scale {scaleLinear, scaleExp2, scaleGainDb, scaleLabels};
+	Scale scale = scaleLinear;
+	int precision = 2;
+	const char *suffix = "";
+	// Only for `scaleLabels`: the value is rounded to an index
+	const char * const *labels = nullptr;
+	uint32_t labelCount = 0;
+
+	static constexpr ParamFormat number(int precision=2, const char *suffix="") {
+		ParamFormat format;
+		format.precision = precision;
+		format.suffix = suffix;
+		return format;
+	}
+	static constexpr ParamFormat hz(int precision=1) {
+		return number(precision, " Hz");
+	}
+	// Value is log2(Hz)
+	static constexpr ParamFormat exp2Hz(int precision=2) {
+		ParamFormat format = hz(precision);
+		format.scale = scaleExp2;
+		return format;
+	}
+	static constexpr ParamFormat db(int precision=1) {
+		return number(precision, " dB");
+	}
+	// Value is linear gain, displayed in dB
+	static constexpr ParamFormat gainDb(int precision=1) {
+		ParamFormat format = db(precision);
+		format.scale = scaleGainDb;
+		return format;
+	}
+	static constexpr ParamFormat ms(int precision=1) {
+		return number(precision, " ms");
+	}
+	static constexpr ParamFormat cents(int precision=0) {
+		return number(precision, " cents");
+	}
+	template<size_t N>
+	static constexpr ParamFormat enumLabels(const char * const (&labels)[N]) {
+		ParamFormat format;
+		format.scale = scaleLabels;
+		format.labels = labels;
+		format.labelCount = uint32_t(N);
+		return format;
+	}
+
+	bool toText(double value, char *text, uint32_t capacity) const {
+		if (!text || !capacity) return false;
+		if (scale == scaleLabels) {
+			if (!labelCount) return false;
+			copyText(labels[labelIndex(value)], text, capacity);
+			return true;
+		}
+		writeNumber(toDisplay(value), text, capacity);
+		return true;
+	}
+
+	// Accepts the output of `.toText()`, or just a number (with an optional "k" for thousands).  Labels are case-insensitive.
+	bool fromText(const char *text, double *value) const {
+		if (!text) return false;
+		while (std::isspace((unsigned char)*text)) ++text;
+		if (scale == scaleLabels) {
+			for (uint32_t i = 0; i < labelCount; ++i) {
+				if (matchesLabel(text, labels[i])) {
+					*value = i;
+					return true;
+				}
+			}
+		}
+		char *end;
+		double display = std::strtod(text, &end);
+		if (end == text) return false;
+		while (*end == ' ') ++end;
+		if (*end == 'k' || *end == 'K') display *= 1000;
+
+		if (scale == scaleLabels) {
+			if (!labelCount) return false;
+			*value = labelIndex(display);
+		} else {
+			*value = fromDisplay(display);
+		}
+		return true;
+	}
+
+	double toDisplay(double value) const {
+		if (scale == scaleExp2) return std::exp2(value);
+		if (scale == scaleGainDb) return (value > 0) ? 20*std::log10(value) : -INFINITY;
+		return value;
+	}
+	double fromDisplay(double display) const {
+		if (scale == scaleExp2) return std::log2(std::max(display, 1e-300));
+		if (scale == scaleGainDb) return std::pow(10, display*0.05);
+		return display;
+	}
+
+private:
+	// Equivalent to `snprintf(text, capacity, "%.*f%s", ...)`, except that exact ties may round differently
+	void writeNumber(double x, char *text, uint32_t capacity) const {
+		static constexpr double powers[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+		if (precision < 0 || precision > 9 || !(std::abs(x)*powers[precision] < 1e18)) {
+			// NaN/inf, or too large for the integer path
+			std::snprintf(text, capacity, "%.*f%s", precision, x, suffix);
+			return;
+		}
+		uint64_t scaled = uint64_t(std::round(std::abs(x)*powers[precision]));
+		char digits[32];
+		char *start = digits + sizeof(digits);
+		for (int i = 0; i < precision; ++i) {
+			*--start = char('0' + scaled%10);
+			scaled /= 10;
+		}
+		if (precision > 0) *--start = '.';
+		do {
+			*--start = char('0' + scaled%10);
+			scaled /= 10;
+		} while (scaled);
+		if (std::signbit(x)) *--start = '-';
+
+		uint32_t length = 0;
+		for (; start < digits + sizeof(digits) && length + 1 < capacity; ++start) text[length++] = *start;
+		for (const char *c = suffix; *c && length + 1 < capacity; ++c) text[length++] = *c;
+		text[length] = 0;
+	}
+
+	uint32_t labelIndex(double value) const {
+		double index = std::round(value);
+		if (!(index > 0)) return 0; // also catches NaN
+		return uint32_t(std::min(index, double(labelCount - 1)));
+	}
+
+	static void copyText(const char *from, char *text, uint32_t capacity) {
+		std::strncpy(text, from, capacity);
+		text[capacity - 1] = 0;
+	}
+	
+	static bool matchesLabel(const char *text, const char *label) {
+		for (; *label; ++text, ++label) {
+			if (std::tolower((unsigned char)*text) != std::tolower((unsigned char)*label)) return false;
+		}
+		while (std::isspace((unsigned char)*text)) ++text;
+		return !*text;
+	}
+};
+
+/** Published parameter values, for reading from other threads without tearing.
+
+Values are stored contiguously (in cache-line-sized groups), separate from everything else about the parameters.  A sequence counter (seqlock) lets readers take a consistent `.snapshot()` of every value, retrying if a write happened during the copy.  Writes are wait-free, but there must only be one writer at a time: the audio thread while the plugin is active, otherwise the main thread.  Changes from other threads (e.g. loading state while active) should go through a `ParamChangeQueue`.
+*/
+struct ParamValueStore {
+	// Sets up a parameter list to publish into this store - call from the main thread while not processing
+	template<class List>
+	void attach(const List &params) {
+		resize(params.size());
+		size_t index = 0;
+		for (auto *param : params) {
+			param->valueStore = this;
+			param->valueIndex = index;
+			set(index, param->value);
+			++index;
+		}
+	}
+
+	size_t size() const {
+		return count;
+	}
+	// Allocates space for values which aren't attached to a `Param` - call from the main thread while not processing
+	void resize(size_t size) {
+		count = size;
+		lines.reset(new Line[(count + Line::size - 1)/Line::size]);
+	}
+
+	// Single writer (normally the audio thread)
+	void set(size_t index, double value) {
+		sequence.fetch_add(1, std::memory_order_relaxed); // odd: write in progress
+		std::atomic_thread_fence(std::memory_order_release);
+		slot(index).store(value, std::memory_order_relaxed);
+		sequence.fetch_add(1, std::memory_order_release);
+	}
+
+	// Readers: a single value can't tear, so this doesn't need the sequence
+	double get(size_t index) const {
+		return slot(index).load(std::memory_order_relaxed);
+	}
+	// Copies all values (`out` must have space for `.size()`), consistent with a single point in time
+	void snapshot(double *out) const {
+		while (true) {
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			if (before&1) continue;
+			for (size_t i = 0; i < count; ++i) out[i] = get(i);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == before) return;
+		}
+	}
+	void snapshot(std::vector<double> &out) const {
+		out.resize(count);
+		snapshot(out.data());
+	}
+
+private:
+	struct alignas(64) Line {
+		static constexpr size_t size = 64/sizeof(std::atomic<double>);
+		std::atomic<double> values[size];
+	};
+	alignas(64) std::atomic<uint32_t> sequence{0};
+	std::unique_ptr<Line[]> lines;
+	size_t count = 0;
+
+	std::atomic<double> & slot(size_t index) const {
+		return lines[index/Line::size].values[index%Line::size];
+	}
+};
+
 /** A parameter object which can send gesture/value events back to the host when needed.
 
 It can also track whether its value has been sent to the UI or not, but doesn't specify how that should be done.
+
+User interactions should use `.markGestureStart()`/`.markValue()`/`.markGestureEnd()` rather than clearing the `sent...` flags directly, so that a `ParamManager` can find them without checking every parameter.
 */
 struct Param {
 	double value = 0;
 	clap_param_info info;
-	const char *formatString = "%.2f";
-	std::function<std::string(double)> formatFn;
+	ParamFormat format; // value <-> text, without allocating
+	const char *formatString = nullptr; // if set, this is used with `std::snprintf()` instead of `.format`
+	std::function<std::string(double)> formatFn; // if set, this takes priority (but allocates)
 	const char *key; // useful when debugging, or when an integer key is awkward
+	ParamRamp ramp; // sample-accurate smoothing, if `ramp.rampMs` is set before `.configure()`
 	
 	// User interactions which we need to send as events to the host
 	std::atomic_flag sentValue = ATOMIC_FLAG_INIT;
@@ -29,6 +419,23 @@ struct Param {
 
 	// Value change which we might need to send to the UI
 	std::atomic_flag sentUiState = ATOMIC_FLAG_INIT;
+	
+	// Set by `ParamManager`, so it only has to check parameters which have changed
+	ParamDirtyBits *dirtyBits = nullptr;
+	uint64_t dirtyBit = 0;
+	// Set by `ParamValueStore::attach()`, so other threads can read the value safely
+	ParamValueStore *valueStore = nullptr;
+	size_t valueIndex = 0;
+	// Used by `ParamChangeQueue` when thinning out UI changes
+	struct AutomationState {
+		double sentTime = -1e300, sentValue = 0;
+		double sendClock = -1e300; // when the last value event was sent (by the clock given to `.drain()`), for the rate limit
+		double latestTime = 0, latestValue = 0;
+		double minTime = 0, minValue = 0, maxTime = 0, maxValue = 0;
+		bool pending = false, listed = false;
+	} automation;
+	// Bumped by `.markInfoChanged()`/`.markTextChanged()`, so `ParamManager` (or a UI) can tell what the host hasn't seen yet
+	uint32_t infoVersion = 0, textVersion = 0;
 
 	Param(const char *key, const char *name, clap_id paramId, double min, double initial, double max) : key(key), value(initial) {
 		info = {
@@ -46,67 +453,139 @@ struct Param {
 		sentValue.test_and_set();
 		sentGestureStart.test_and_set();
 		sentGestureEnd.test_and_set();
+		ramp.reset(initial);
 	}
 	Param(const Param &other) = delete;
 	
 	void invalidate() {
 		sentUiState.clear();
-		sentValue.clear();
+		markValue();
 	}
 	
+	bool valueToText(double v, char *text, uint32_t textCapacity) const {
+		if (formatFn) {
+			auto str = formatFn(v);
+			std::strncpy(text, str.c_str(), textCapacity);
+			return true;
+		} else if (formatString) {
+			return std::snprintf(text, textCapacity, formatString, v) >= 0;
+		}
+		return format.toText(v, text, textCapacity);
+	}
+	// Parses (and clamps to the range) a value
+	bool textToValue(const char *text, double *v) const {
+		if (!format.fromText(text, v)) return false;
+		*v = std::max(info.min_value, std::min(info.max_value, *v));
+		return true;
+	}
+
 	void setValueFromEvent(const clap_event_param_value &paramEvent) {
 		value = paramEvent.value;
+		publishValue();
 		sentUiState.clear();
+		if (ramp.enabled()) ramp.addEvent(paramEvent.header.time, value);
+	}
+	
+	// Call after changing `.value` directly, if there's a value store
+	void publishValue() {
+		if (valueStore) valueStore->set(valueIndex, value);
+	}
+	// Safe to call from any thread, if there's a value store
+	double publishedValue() const {
+		return valueStore ? valueStore->get(valueIndex) : value;
+	}
+	
+	void configure(double sampleRate, uint32_t maxFrames) {
+		ramp.configure(sampleRate, maxFrames);
+		ramp.reset(value);
+	}
+
+	/* Fills `ramp.data()` for this block, or returns `false` if the value is static (including when smoothing is disabled).
+
+	This must be called once per block when smoothing is enabled, after all the block's events have been passed in.  Changes to `.value` made outside of events (e.g. from the UI or loading state) start ramping from the beginning of the block.
+	*/
+	bool smooth(uint32_t frames) {
+		if (!ramp.enabled()) return false;
+		if (ramp.targetValue() != value) ramp.addEvent(0, value);
+		return ramp.process(frames);
+	}
+	// Current smoothed value - the end of the latest block if it's ramping
+	double smoothedValue() const {
+		return ramp.enabled() ? ramp.value() : value;
+	}
+
+	// Marking things which need to be sent to the host (from any thread)
+	void markGestureStart() {
+		sentGestureStart.clear();
+		markDirty(&ParamDirtyBits::gestureStart);
+	}
+	void markValue() {
+		sentValue.clear();
+		markDirty(&ParamDirtyBits::value);
+	}
+	void markGestureEnd() {
+		sentGestureEnd.clear();
+		markDirty(&ParamDirtyBits::gestureEnd);
+	}
+	// Call (on the main thread) after changing `.info`, or anything which changes the value-to-text conversion
+	void markInfoChanged() {
+		++infoVersion;
+		if (dirtyBits) dirtyBits->info.fetch_or(dirtyBit, std::memory_order_release);
+	}
+	void markTextChanged() {
+		++textVersion;
+		if (dirtyBits) dirtyBits->info.fetch_or(dirtyBit, std::memory_order_release);
 	}
 
 	void sendEvents(const clap_output_events *outEvents) {
-		if (!sentGestureStart.test_and_set()) {
-			clap_event_param_gesture event{
-				.header={
-					.size=sizeof(clap_event_param_gesture),
-					.time=0,
-					.space_id=CLAP_CORE_EVENT_SPACE_ID,
-					.type=CLAP_EVENT_PARAM_GESTURE_BEGIN,
-					.flags=CLAP_EVENT_IS_LIVE
-				},
-				.param_id=info.id
-			};
-			outEvents->try_push(outEvents, &event.header);
-		}
-		if (!sentValue.test_and_set()) {
-			clap_event_param_value event{
-				.header={
-					.size=sizeof(clap_event_param_value),
-					.time=0,
-					.space_id=CLAP_CORE_EVENT_SPACE_ID,
-					.type=CLAP_EVENT_PARAM_VALUE,
-					.flags=CLAP_EVENT_IS_LIVE
-				},
-				.param_id=info.id,
-				.cookie=this,
-				.note_id=-1,
-				.port_index=-1,
-				.channel=-1,
-				.key=-1,
-				.value=value
-			};
-			outEvents->try_push(outEvents, &event.header);
-		}
-		if (!sentGestureEnd.test_and_set()) {
-			clap_event_param_gesture event{
-				.header={
-					.size=sizeof(clap_event_param_gesture),
-					.time=0,
-					.space_id=CLAP_CORE_EVENT_SPACE_ID,
-					.type=CLAP_EVENT_PARAM_GESTURE_END,
-					.flags=CLAP_EVENT_IS_LIVE
-				},
-				.param_id=info.id
-			};
-			outEvents->try_push(outEvents, &event.header);
-		}
+		if (!sentGestureStart.test_and_set()) pushGesture(outEvents, CLAP_EVENT_PARAM_GESTURE_BEGIN);
+		if (!sentValue.test_and_set()) pushValue(outEvents);
+		if (!sentGestureEnd.test_and_set()) pushGesture(outEvents, CLAP_EVENT_PARAM_GESTURE_END);
+	}
+
+	void pushGesture(const clap_output_events *outEvents, uint16_t type) {
+		clap_event_param_gesture event{
+			.header={
+				.size=sizeof(clap_event_param_gesture),
+				.time=0,
+				.space_id=CLAP_CORE_EVENT_SPACE_ID,
+				.type=type,
+				.flags=CLAP_EVENT_IS_LIVE
+			},
+			.param_id=info.id
+		};
+		outEvents->try_push(outEvents, &event.header);
+	}
+	void pushValue(const clap_output_events *outEvents) {
+		pushValue(outEvents, value);
+	}
+	// Sends a specific value, e.g. an earlier one from a queue of UI changes
+	void pushValue(const clap_output_events *outEvents, double v) {
+		clap_event_param_value event{
+			.header={
+				.size=sizeof(clap_event_param_value),
+				.time=0,
+				.space_id=CLAP_CORE_EVENT_SPACE_ID,
+				.type=CLAP_EVENT_PARAM_VALUE,
+				.flags=CLAP_EVENT_IS_LIVE
+			},
+			.param_id=info.id,
+			.cookie=this,
+			.note_id=-1,
+			.port_index=-1,
+			.channel=-1,
+			.key=-1,
+			.value=v
+		};
+		outEvents->try_push(outEvents, &event.header);
 	}
 	
+	void markDirty(std::atomic<uint64_t> ParamDirtyBits::*kind) {
+		if (!dirtyBits) return;
+		(dirtyBits->*kind).fetch_or(dirtyBit, std::memory_order_release);
+		dirtyBits->any.fetch_or(dirtyBit, std::memory_order_release);
+	}
+
 	template<class Storage>
 	void state(Storage &storage) {
 		storage("value", value);
@@ -123,31 +602,552 @@ struct Param {
 	}
 };
 
+/** A bounded single-producer/single-consumer queue of UI changes, so the UI thread never writes to parameters directly.
+
+The UI thread calls `.gestureStart()`/`.value()`/`.gestureEnd()`, which are wait-free and return `false` (counting an overflow) if the queue is full.  The audio thread calls `.drain()`, which applies every change in order and sends the matching host events.  Values from loading state use `.load()` (from the same thread as the UI) and aren't sent to the host.
+
+By default every intermediate value from a drag is sent to the host.  If `.maxEventRate` is set, value events for each parameter are thinned out to that rate: the latest value is sent when the interval is up, unless the skipped values include a turning point further than `.tolerance` (as a fraction of the parameter's range) from the straight line, in which case that's sent first (and the latest value waits for the next interval).  The final value is always sent, at the latest just before the gesture ends, even if that's sooner than the interval.
+*/
+struct ParamChangeQueue {
+	enum Flags : uint8_t {changeGestureStart=1, changeValue=2, changeGestureEnd=4, changeLoad=8};
+	struct Change {
+		Param *param;
+		double value; // only used with `changeValue`
+		double time; // seconds, from `ParamChangeQueue::now()`
+		uint8_t flags;
+	};
+
+	double maxEventRate = 0; // per parameter, in Hz (0 = unlimited)
+	double tolerance = 0.01;
+
+	ParamChangeQueue(size_t capacity=1024, size_t maxThinnedParams=64) {
+		size_t size = 2;
+		while (size < capacity) size *= 2;
+		changes.resize(size);
+		mask = size - 1;
+		pendingParams.reserve(maxThinnedParams);
+	}
+	
+	static double now() {
+		using Clock = std::chrono::steady_clock;
+		return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+	}
+	
+	// UI thread - gestures don't carry a value, since `param.value` belongs to the audio thread
+	bool gestureStart(Param &param) {
+		return push({&param, 0, now(), changeGestureStart});
+	}
+	bool value(Param &param, double value) {
+		return push({&param, value, now(), changeValue});
+	}
+	bool gestureEnd(Param &param) {
+		return push({&param, 0, now(), changeGestureEnd});
+	}
+	// Main thread, for loading state while the audio thread is running: the value is applied and published, but not sent to the host
+	bool load(Param &param, double value) {
+		return push({&param, value, now(), changeValue|changeLoad});
+	}
+	bool push(const Change &change) {
+		size_t write = writeIndex.load(std::memory_order_relaxed);
+		if (write - readIndex.load(std::memory_order_acquire) > mask) {
+			overflowCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		changes[write&mask] = change;
+		writeIndex.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Audio thread (or wherever the host events are sent from) - returns the number of changes applied
+	size_t drain(const clap_output_events *eventsOut, double time=now()) {
+		clock = time;
+		size_t read = readIndex.load(std::memory_order_relaxed);
+		size_t write = writeIndex.load(std::memory_order_acquire);
+		size_t count = write - read;
+		if (count > maxDrained.load(std::memory_order_relaxed)) maxDrained.store(count, std::memory_order_relaxed);
+		for (; read != write; ++read) {
+			auto &change = changes[read&mask];
+			auto *param = change.param;
+			if (change.flags&changeGestureStart) {
+				flushThinned(*param, eventsOut); // anything left from a previous gesture
+				param->pushGesture(eventsOut, CLAP_EVENT_PARAM_GESTURE_BEGIN);
+			}
+			if (change.flags&changeValue) {
+				param->value = change.value;
+				param->publishValue();
+				if (param->ramp.enabled()) param->ramp.addEvent(0, change.value);
+				if (change.flags&changeLoad) {
+					param->sentUiState.clear();
+					loadedValues = true;
+					continue;
+				}
+				valuesReceived.fetch_add(1, std::memory_order_relaxed);
+				if (maxEventRate > 0) {
+					addThinned(*param, change.time, change.value, eventsOut);
+				} else {
+					flushThinned(*param, eventsOut); // anything left from before the rate limit was removed
+					sendValue(*param, change.time, change.value, eventsOut);
+				}
+			}
+			if (change.flags&changeGestureEnd) {
+				flushThinned(*param, eventsOut);
+				param->pushGesture(eventsOut, CLAP_EVENT_PARAM_GESTURE_END);
+			}
+		}
+		readIndex.store(read, std::memory_order_release);
+		
+		// Parameters which are waiting for their interval to pass
+		for (size_t i = 0; i < pendingParams.size();) {
+			auto &param = *pendingParams[i];
+			tickThinned(param, eventsOut);
+			if (param.automation.pending) {
+				++i;
+			} else {
+				param.automation.listed = false;
+				pendingParams[i] = pendingParams.back();
+				pendingParams.pop_back();
+			}
+		}
+		return count;
+	}
+	
+	// Diagnostics, safe to read from any thread
+	size_t overflows() const {
+		return overflowCount.load(std::memory_order_relaxed);
+	}
+	size_t highWaterMark() const {
+		return maxDrained.load(std::memory_order_relaxed);
+	}
+	size_t capacity() const {
+		return changes.size();
+	}
+	// Audio thread: whether any `.load()`ed values have been applied since the last call, so the UI can be refreshed
+	bool takeLoaded() {
+		bool result = loadedValues;
+		loadedValues = false;
+		return result;
+	}
+	// Thinned values are waiting to be sent, so `.drain()` should be called again soon
+	bool waiting() const {
+		return !pendingParams.empty();
+	}
+	// Sends any waiting values immediately, e.g. from `clap_plugin_params.flush()` when there are no regular blocks
+	void flushWaiting(const clap_output_events *eventsOut, double time=now()) {
+		clock = time;
+		for (auto *param : pendingParams) {
+			flushThinned(*param, eventsOut);
+			param->automation.listed = false;
+		}
+		pendingParams.clear();
+	}
+	// Values which weren't sent to the host (including ones still waiting)
+	size_t coalesced() const {
+		return valuesReceived.load(std::memory_order_relaxed) - valuesSent.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::vector<Change> changes;
+	size_t mask;
+	alignas(64) std::atomic<size_t> writeIndex{0};
+	alignas(64) std::atomic<size_t> readIndex{0};
+	alignas(64) std::atomic<size_t> overflowCount{0}, maxDrained{0};
+	std::atomic<size_t> valuesReceived{0}, valuesSent{0};
+	std::vector<Param *> pendingParams; // never grows past its initial capacity
+	bool loadedValues = false;
+	double clock = 0; // from the latest `.drain()`/`.flushWaiting()`
+
+	// Whether another value event fits in the rate limit
+	bool canSend(const Param::AutomationState &state) const {
+		return maxEventRate <= 0 || clock - state.sendClock >= 1/maxEventRate;
+	}
+
+	void sendValue(Param &param, double time, double value, const clap_output_events *eventsOut) {
+		auto &state = param.automation;
+		state.sentTime = time;
+		state.sentValue = value;
+		state.sendClock = clock;
+		param.pushValue(eventsOut, value); // not `param.value`, which might be further along than this one
+		valuesSent.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void addThinned(Param &param, double time, double value, const clap_output_events *eventsOut) {
+		auto &state = param.automation;
+		if (!state.pending) {
+			if (canSend(state)) {
+				// Nothing waiting, and it's been long enough
+				return sendValue(param, time, value, eventsOut);
+			}
+			if (!state.listed) {
+				if (pendingParams.size() == pendingParams.capacity()) {
+					// Can't allocate here, so send it without thinning
+					return sendValue(param, time, value, eventsOut);
+				}
+				pendingParams.push_back(&param);
+				state.listed = true;
+			}
+			state.pending = true;
+			state.minTime = state.maxTime = time;
+			state.minValue = state.maxValue = value;
+		} else {
+			if (value < state.minValue) {
+				state.minTime = time;
+				state.minValue = value;
+			}
+			if (value > state.maxValue) {
+				state.maxTime = time;
+				state.maxValue = value;
+			}
+		}
+		state.latestTime = time;
+		state.latestValue = value;
+	}
+
+	// Sends the skipped turning point, if it's too far from a straight line
+	bool sendTurningPoint(Param &param, const clap_output_events *eventsOut) {
+		auto &state = param.automation;
+		double limit = tolerance*std::abs(param.info.max_value - param.info.min_value);
+		auto deviation = [&](double t, double v) {
+			double duration = state.latestTime - state.sentTime;
+			double r = (duration > 0) ? (t - state.sentTime)/duration : 1;
+			return std::abs(v - (state.sentValue + (state.latestValue - state.sentValue)*r));
+		};
+		double minDev = deviation(state.minTime, state.minValue);
+		double maxDev = deviation(state.maxTime, state.maxValue);
+		if (std::max(minDev, maxDev) <= limit) return false;
+		if (minDev > maxDev) {
+			sendValue(param, state.minTime, state.minValue, eventsOut);
+		} else {
+			sendValue(param, state.maxTime, state.maxValue, eventsOut);
+		}
+		// Start a new window with just the latest value
+		state.minTime = state.maxTime = state.latestTime;
+		state.minValue = state.maxValue = state.latestValue;
+		return true;
+	}
+
+	void tickThinned(Param &param, const clap_output_events *eventsOut) {
+		auto &state = param.automation;
+		if (!state.pending || !canSend(state)) return;
+		// The turning point uses up this interval, so the latest value waits for the next one (unless there's no limit any more)
+		if (sendTurningPoint(param, eventsOut) && maxEventRate > 0) return;
+		state.pending = false;
+		sendValue(param, state.latestTime, state.latestValue, eventsOut);
+	}
+	
+	void flushThinned(Param &param, const clap_output_events *eventsOut) {
+		auto &state = param.automation;
+		if (!state.pending) return;
+		if (canSend(state)) sendTurningPoint(param, eventsOut); // the final value can skip the rate limit, but the turning point can't
+		state.pending = false;
+		sendValue(param, state.latestTime, state.latestValue, eventsOut);
+	}
+};
+
+/** Maps parameter IDs to parameters in constant time, using a small open-addressed hash table.
+
+This only stores pointers, so it has to be rebuilt if the parameter list changes.  It works for any parameter type with an `.info.id`.
+*/
+template<class P=Param>
+struct ParamIndex {
+	template<class List>
+	void build(const List &params) {
+		size_t tableSize = 4;
+		while (tableSize < size_t(params.size())*2) tableSize *= 2;
+		table.assign(tableSize, Entry{0, nullptr}); // empty slots have a null `param`
+		mask = tableSize - 1;
+		for (auto *param : params) {
+			// Linear probing
+			size_t i = slot(param->info.id);
+			while (table[i].param && table[i].id != param->info.id) i = (i + 1)&mask;
+			if (!table[i].param) table[i] = {param->info.id, param}; // first one wins, like the linear scan did
+		}
+	}
+
+	// Returns `nullptr` if the ID isn't found
+	P * find(clap_id paramId) const {
+		if (table.empty()) return nullptr;
+		size_t i = slot(paramId);
+		while (table[i].param) {
+			if (table[i].id == paramId) return table[i].param;
+			i = (i + 1)&mask;
+		}
+		return nullptr;
+	}
+
+private:
+	struct Entry {
+		clap_id id;
+		P *param;
+	};
+	std::vector<Entry> table;
+	size_t mask = 0;
+
+	size_t slot(clap_id paramId) const {
+		return size_t((uint64_t(paramId)*0x9E3779B97F4A7C15ull) >> 32)&mask;
+	}
+};
+
+/** Modulation offsets from `CLAP_EVENT_PARAM_MOD`, in dense per-voice arrays.
+
+For each parameter, `.offsets(paramIndex)` has one entry per voice index (combining the monophonic and per-note modulation), so a voice kernel can add them to the base value for all voices in one pass.  Per-note events are matched to voices with `notes.forEachMatchEvent()` (e.g. a `NoteManager`), the same way as note expressions.
+*/
+struct ParamModulation {
+	static constexpr size_t alignFloats = 16; // rows start on 64-byte boundaries
+
+	void resize(size_t paramCount, size_t polyphony) {
+		this->polyphony = polyphony;
+		stride = (polyphony + alignFloats - 1)/alignFloats*alignFloats;
+		storage.assign(paramCount*stride + alignFloats, 0);
+		auto address = reinterpret_cast<std::uintptr_t>(storage.data());
+		alignOffset = ((alignFloats*sizeof(float) - address%(alignFloats*sizeof(float)))%(alignFloats*sizeof(float)))/sizeof(float);
+		voiceAmounts.assign(paramCount*stride, 0);
+		globalAmounts.assign(paramCount, 0);
+		voiceNoteIds.assign(polyphony, -1);
+	}
+	
+	void reset() {
+		std::fill(storage.begin(), storage.end(), 0.0f);
+		std::fill(voiceAmounts.begin(), voiceAmounts.end(), 0.0f);
+		std::fill(globalAmounts.begin(), globalAmounts.end(), 0.0);
+		std::fill(voiceNoteIds.begin(), voiceNoteIds.end(), -1);
+	}
+	
+	bool enabled() const {
+		return !globalAmounts.empty();
+	}
+
+	// Total offset for each voice index, aligned to 64 bytes
+	const float * offsets(size_t paramIndex) const {
+		return storage.data() + alignOffset + paramIndex*stride;
+	}
+	double globalOffset(size_t paramIndex) const {
+		return globalAmounts[paramIndex];
+	}
+	
+	void setGlobal(size_t paramIndex, double amount) {
+		globalAmounts[paramIndex] = amount;
+		float *row = mutableOffsets(paramIndex);
+		const float *voiceRow = voiceAmounts.data() + paramIndex*stride;
+		for (size_t v = 0; v < polyphony; ++v) row[v] = float(amount + voiceRow[v]);
+	}
+	void setVoice(size_t paramIndex, size_t voiceIndex, double amount) {
+		voiceAmounts[paramIndex*stride + voiceIndex] = float(amount);
+		mutableOffsets(paramIndex)[voiceIndex] = float(globalAmounts[paramIndex] + amount);
+	}
+
+	/* Call when a voice starts a new note, so it doesn't inherit the previous note's modulation.
+	
+	Modulation which already arrived for this note ID (e.g. earlier in the same block) is kept.  Notes without an ID always start from zero.
+	*/
+	void startVoice(size_t voiceIndex, int32_t noteId) {
+		if (noteId == -1 || voiceNoteIds[voiceIndex] != noteId) clearVoice(voiceIndex);
+		voiceNoteIds[voiceIndex] = noteId;
+	}
+
+	// Monophonic modulation only
+	void processEvent(const clap_event_param_mod &event, size_t paramIndex) {
+		if (isGlobal(event)) setGlobal(paramIndex, event.amount);
+	}
+	// Monophonic or per-note modulation
+	template<class Notes>
+	void processEvent(const clap_event_param_mod &event, size_t paramIndex, const Notes &notes) {
+		if (isGlobal(event)) return setGlobal(paramIndex, event.amount);
+		// Released notes are still sounding, so they get modulated too
+		notes.forEachMatchEvent(event, [&](const auto &note){
+			size_t voice = note.voiceIndex;
+			if (voiceNoteIds[voice] != note.noteId) {
+				// Modulation for a new note, before `.startVoice()`
+				clearVoice(voice);
+				voiceNoteIds[voice] = note.noteId;
+			}
+			setVoice(paramIndex, voice, event.amount);
+		}, true);
+	}
+
+private:
+	size_t polyphony = 0, stride = 0, alignOffset = 0;
+	std::vector<float> storage, voiceAmounts;
+	std::vector<double> globalAmounts;
+	std::vector<int32_t> voiceNoteIds;
+	
+	float * mutableOffsets(size_t paramIndex) {
+		return storage.data() + alignOffset + paramIndex*stride;
+	}
+
+	static bool isGlobal(const clap_event_param_mod &event) {
+		return event.note_id == -1 && event.port_index < 0 && event.channel < 0 && event.key < 0;
+	}
+
+	void clearVoice(size_t voiceIndex) {
+		for (size_t p = 0; p < globalAmounts.size(); ++p) {
+			voiceAmounts[p*stride + voiceIndex] = 0;
+			mutableOffsets(p)[voiceIndex] = float(globalAmounts[p]);
+		}
+	}
+};
+
 /** A collection of Parameters */
 struct ParamManager {
 
 	ParamManager & add() {
+		index.build(paramList);
+		values.attach(paramList);
+		dirtyBits.reset(new ParamDirtyBits[(paramList.size() + 63)/64]);
+		hostInfo.resize(paramList.size());
+		for (size_t i = 0; i < paramList.size(); ++i) {
+			auto *param = paramList[i];
+			param->dirtyBits = &dirtyBits[i/64];
+			param->dirtyBit = uint64_t(1) << (i%64);
+			hostInfo[i] = HostInfo(*param);
+			// Anything already waiting to be sent
+			if (!param->sentGestureStart.test_and_set()) param->markGestureStart();
+			if (!param->sentValue.test_and_set()) param->markValue();
+			if (!param->sentGestureEnd.test_and_set()) param->markGestureEnd();
+		}
 		return *this;
 	}
 	template<class... Others>
-	ParamManager & add(Param &param, Others ...others) {
+	ParamManager & add(Param &param, Others &...others) {
 		paramList.push_back(&param);
 		return add(others...);
 	}
 	
+	// Returns `nullptr` if there's no parameter with this ID
+	Param * find(clap_id paramId) const {
+		return index.find(paramId);
+	}
+	
+	// Changes from the UI, applied by `.sendEvents()`
+	ParamChangeQueue uiChanges;
+	// Values published by the audio thread, for everyone else to read
+	ParamValueStore values;
+	// Modulation offsets, indexed by parameter position and voice - call `.configureModulation()` to enable
+	ParamModulation modulation;
+	
 	void init(const clap_host *host) {
+		this->host = host;
 		getHostExtension(host, CLAP_EXT_PARAMS, hostParams);
 	}
 	
+	// Asks the host to call `.paramsFlush()` if we're not processing, so queued UI changes get sent.  Repeated requests before the next `.sendEvents()` are coalesced.
+	void requestFlush() {
+		if (hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
+	}
+	
+	// Sets up the smoothing for any parameters with a ramp time
+	void configure(double sampleRate, uint32_t maxFrames) {
+		for (auto *param : paramList) param->configure(sampleRate, maxFrames);
+	}
+	// Allocates the per-voice modulation arrays, after all the parameters are added
+	void configureModulation(size_t polyphony) {
+		modulation.resize(paramList.size(), polyphony);
+	}
+	// Jumps any smoothed parameters to their current value
+	void resetRamps() {
+		for (auto *param : paramList) param->ramp.reset(param->value);
+	}
+	
 	void clearUiState() {
 		for (auto *param : paramList) {
 			param->sentUiState.clear();
 		}
 	}
+	
+	// Marks a rescan which isn't tied to one parameter's info (e.g. `CLAP_PARAM_RESCAN_VALUES` after loading state, or `CLAP_PARAM_RESCAN_ALL` after adding parameters) - safe from any thread
+	void markRescan(clap_param_rescan_flags flags) {
+		pendingRescan.fetch_or(flags, std::memory_order_release);
+	}
+	// Asks the host to drop automation/modulation for a parameter, sent by the next `.rescan()` (main thread)
+	void clear(clap_id paramId, clap_param_clear_flags flags) {
+		for (auto &c : pendingClears) {
+			if (c.paramId == paramId) {
+				c.flags |= flags;
+				return;
+			}
+		}
+		pendingClears.push_back({paramId, flags});
+	}
+	
+	/* Sends pending clears, then tells the host about everything marked since the last call with a single `hostParams->rescan()`, using the narrowest flags which cover it.  Main thread only.
+
+	Info changes are compared against what the host last saw: name/module/periodic/hidden only need `CLAP_PARAM_RESCAN_INFO`, anything else (range, default, cookie, other flags) needs `CLAP_PARAM_RESCAN_ALL`.  That's only allowed while deactivated, so if `pluginActive` is set this requests a restart instead, and holds everything until it's called again after `deactivate()`.
+
+	Returns the flags sent to the host (or 0 if there was nothing to send).
+	*/
+	clap_param_rescan_flags rescan(bool pluginActive) {
+		uint32_t flags = pendingRescan.exchange(0, std::memory_order_acquire)|deferredRescan;
+		deferredRescan = 0;
+		size_t groups = (paramList.size() + 63)/64;
+		for (size_t g = 0; g < groups; ++g) {
+			auto &bits = dirtyBits[g];
+			if (!bits.info.load(std::memory_order_relaxed)) continue;
+			uint64_t changed = bits.info.exchange(0, std::memory_order_acquire);
+			while (changed) {
+				uint64_t bit = changed&(~changed + 1);
+				changed ^= bit;
+				size_t i = g*64 + _impl::lowestBit64(bit);
+				auto &param = *paramList[i];
+				auto &seen = hostInfo[i];
+				if (seen.textVersion != param.textVersion) flags |= CLAP_PARAM_RESCAN_TEXT;
+				if (seen.infoVersion != param.infoVersion) {
+					HostInfo current(param);
+					flags |= HostInfo::rescanFlags(seen, current);
+					seen = current;
+				}
+				seen.textVersion = param.textVersion;
+			}
+		}
+		if (flags&CLAP_PARAM_RESCAN_ALL) {
+			if (pluginActive) {
+				deferredRescan = flags;
+				if (host) host->request_restart(host);
+				return 0;
+			}
+			flags = CLAP_PARAM_RESCAN_ALL;
+		}
+		if (!hostParams) {
+			pendingClears.clear();
+			return flags;
+		}
+		for (auto &c : pendingClears) hostParams->clear(host, c.paramId, c.flags);
+		pendingClears.clear();
+		if (flags) hostParams->rescan(host, flags);
+		return flags;
+	}
 
+	// Applies queued UI changes, and sends events for marked parameters - this only visits groups of 64 which have something to send
 	void sendEvents(const clap_output_events *eventsOut) {
-		for (auto *param : paramList) {
-			param->sendEvents(eventsOut);
+		flushRequested.clear();
+		uiChanges.drain(eventsOut);
+		size_t groups = (paramList.size() + 63)/64;
+		for (size_t g = 0; g < groups; ++g) {
+			auto &bits = dirtyBits[g];
+			if (!bits.any.load(std::memory_order_relaxed)) continue;
+			bits.any.exchange(0, std::memory_order_acquire);
+			uint64_t gestureStart = bits.gestureStart.exchange(0, std::memory_order_acquire);
+			uint64_t value = bits.value.exchange(0, std::memory_order_acquire);
+			uint64_t gestureEnd = bits.gestureEnd.exchange(0, std::memory_order_acquire);
+
+			uint64_t pending = gestureStart|value|gestureEnd;
+			while (pending) {
+				uint64_t bit = pending&(~pending + 1);
+				pending ^= bit;
+				size_t i = g*64 + _impl::lowestBit64(bit);
+				auto *param = paramList[i];
+				// Keep the per-parameter flags in sync, in case anyone calls `Param::sendEvents()` directly
+				if (gestureStart&bit) {
+					param->sentGestureStart.test_and_set();
+					param->pushGesture(eventsOut, CLAP_EVENT_PARAM_GESTURE_BEGIN);
+				}
+				if (value&bit) {
+					param->sentValue.test_and_set();
+					param->pushValue(eventsOut);
+				}
+				if (gestureEnd&bit) {
+					param->sentGestureEnd.test_and_set();
+					param->pushGesture(eventsOut, CLAP_EVENT_PARAM_GESTURE_END);
+				}
+			}
 		}
 	}
 	
@@ -161,18 +1161,30 @@ struct ParamManager {
 				param->setValueFromEvent(eventParam);
 			} else {
 				// Otherwise, match the ID
-				for (auto *param : paramList) {
-					if (eventParam.param_id == param->info.id) {
-						param->setValueFromEvent(eventParam);
-						break;
-					}
+				if (auto *param = find(eventParam.param_id)) {
+					param->setValueFromEvent(eventParam);
 				}
 			}
 			return true;
-
+		} else if (event->type == CLAP_EVENT_PARAM_MOD) {
+			auto &modEvent = *(const clap_event_param_mod *)event;
+			auto *param = modEvent.cookie ? (Param *)modEvent.cookie : find(modEvent.param_id);
+			if (param && modulation.enabled()) modulation.processEvent(modEvent, param->valueIndex);
+			return true;
 		}
 		return false;
 	}
+	// Also handles per-note modulation, using `notes.forEachMatchEvent()` (e.g. from a `NoteManager`)
+	template<class Notes>
+	bool processEvent(const clap_event_header *event, const Notes &notes) {
+		if (event->space_id == CLAP_CORE_EVENT_SPACE_ID && event->type == CLAP_EVENT_PARAM_MOD) {
+			auto &modEvent = *(const clap_event_param_mod *)event;
+			auto *param = modEvent.cookie ? (Param *)modEvent.cookie : find(modEvent.param_id);
+			if (param && modulation.enabled()) modulation.processEvent(modEvent, param->valueIndex, notes);
+			return true;
+		}
+		return processEvent(event);
+	}
 	
 	template<auto memberPtr>
 	const void * ext() {
@@ -198,32 +1210,20 @@ struct ParamManager {
 	}
 	
 	bool paramsGetValue(clap_id paramId, double *value) {
-		for (auto *param : paramList) {
-			if (param->info.id == paramId) {
-				*value = param->value;
-				return true;
-			}
-		}
-		return false;
+		auto *param = find(paramId);
+		if (!param) return false;
+		*value = param->publishedValue();
+		return true;
 	}
 	
 	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
-		for (auto *param : paramList) {
-			if (param->info.id == paramId) {
-				if (param->formatFn) {
-					auto str = param->formatFn(value);
-					std::strncpy(text, str.c_str(), textCapacity);
-				} else {
-					std::snprintf(text, textCapacity, param->formatString, value);
-				}
-				return true;
-			}
-		}
-		return false;
+		auto *param = find(paramId);
+		return param && param->valueToText(value, text, textCapacity);
 	}
 
 	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
-		return false; // not supported (yet)
+		auto *param = find(paramId);
+		return param && param->textToValue(text, value);
 	}
 	
 	void paramsFlush(const clap_input_events *eventsIn, const clap_output_events *eventsOut) {
@@ -234,11 +1234,222 @@ struct ParamManager {
 			eventsOut->try_push(eventsOut, event);
 		}
 		sendEvents(eventsOut);
+		// We might not get another call soon (and can't request one from the audio thread), so send everything
+		uiChanges.flushWaiting(eventsOut);
 	}
 
 private:
 	std::vector<Param *> paramList;
+	ParamIndex<> index;
+	std::unique_ptr<ParamDirtyBits[]> dirtyBits;
+	const clap_host *host = nullptr;
+	std::atomic_flag flushRequested = ATOMIC_FLAG_INIT;
+
+	// What the host has been told about each parameter, for working out the narrowest rescan
+	struct HostInfo {
+		uint32_t infoVersion = 0, textVersion = 0;
+		clap_id id = 0;
+		clap_param_info_flags flags = 0;
+		void *cookie = nullptr;
+		double min = 0, max = 0, defaultValue = 0;
+		uint64_t textHash = 0; // name and module, so we don't keep a copy of every string
+
+		HostInfo() {}
+		HostInfo(const Param &param) : infoVersion(param.infoVersion), textVersion(param.textVersion), id(param.info.id), flags(param.info.flags), cookie(param.info.cookie), min(param.info.min_value), max(param.info.max_value), defaultValue(param.info.default_value) {
+			textHash = hashText(param.info.name, CLAP_NAME_SIZE, 0xcbf29ce484222325ull);
+			textHash = hashText(param.info.module, CLAP_PATH_SIZE, textHash);
+		}
+		
+		static clap_param_rescan_flags rescanFlags(const HostInfo &before, const HostInfo &after) {
+			// The only flags the CLAP docs allow changing with `CLAP_PARAM_RESCAN_INFO` - anything else might be critical
+			constexpr clap_param_info_flags infoOnlyFlags = CLAP_PARAM_IS_PERIODIC|CLAP_PARAM_IS_HIDDEN;
+			if (before.id != after.id || before.cookie != after.cookie || before.min != after.min || before.max != after.max || before.defaultValue != after.defaultValue) return CLAP_PARAM_RESCAN_ALL;
+			if ((before.flags^after.flags)&~infoOnlyFlags) return CLAP_PARAM_RESCAN_ALL;
+			if (before.flags != after.flags || before.textHash != after.textHash) return CLAP_PARAM_RESCAN_INFO;
+			return 0;
+		}
+		// 64-bit FNV-1a, including the terminating 0 so "ab"+"c" and "a"+"bc" differ
+		static uint64_t hashText(const char *text, size_t capacity, uint64_t hash) {
+			for (size_t i = 0; i < capacity; ++i) {
+				hash = (hash^uint8_t(text[i]))*0x100000001b3ull;
+				if (!text[i]) break;
+			}
+			return hash;
+		}
+	};
+	std::vector<HostInfo> hostInfo;
+	std::atomic<uint32_t> pendingRescan{0};
+	uint32_t deferredRescan = 0;
+	struct PendingClear {
+		clap_id paramId;
+		clap_param_clear_flags flags;
+	};
+	std::vector<PendingClear> pendingClears;
+
 	const clap_host_params *hostParams = nullptr;
 };
 
+/** A compile-time description of one parameter, for `ParamTable` */
+struct ParamSpec {
+	const char *key = "";
+	const char *name = "";
+	clap_id id = 0;
+	double min = 0, initial = 0, max = 1;
+	clap_param_info_flags flags = CLAP_PARAM_IS_AUTOMATABLE;
+	ParamFormat format = {};
+	const char *module = "";
+};
+
+/** A plugin's whole parameter table, built at compile time from a `constexpr` array of `ParamSpec`s:
+
+	static constexpr signalsmith::clap::ParamSpec paramSpecs[] = {...};
+	static constexpr signalsmith::clap::ParamTable paramTable{paramSpecs};
+
+The `clap_param_info`s, default values and ID lookup are all `constexpr`, and parameters are indexed densely by their position.  IDs must be unique.
+*/
+template<size_t N>
+struct ParamTable {
+	static_assert(N > 0, "empty parameter table");
+	std::array<ParamSpec, N> specs = {};
+	std::array<clap_param_info, N> infos = {};
+	std::array<double, N> defaults = {};
+
+	constexpr ParamTable(const ParamSpec (&list)[N]) {
+		for (size_t i = 0; i < N; ++i) {
+			auto &spec = list[i];
+			specs[i] = spec;
+			defaults[i] = spec.initial;
+			auto &info = infos[i];
+			info.id = spec.id;
+			info.flags = spec.flags;
+			info.cookie = nullptr;
+			copyName(spec.name, info.name, CLAP_NAME_SIZE);
+			copyName(spec.module, info.module, CLAP_PATH_SIZE);
+			info.min_value = spec.min;
+			info.max_value = spec.max;
+			info.default_value = spec.initial;
+			
+			// Insertion sort, for the ID lookup
+			size_t j = i;
+			for (; j > 0 && sortedIds[j - 1] > spec.id; --j) {
+				sortedIds[j] = sortedIds[j - 1];
+				sortedIndices[j] = sortedIndices[j - 1];
+			}
+			sortedIds[j] = spec.id;
+			sortedIndices[j] = uint32_t(i);
+		}
+	}
+
+	static constexpr size_t size() {
+		return N;
+	}
+
+	constexpr bool uniqueIds() const {
+		for (size_t i = 1; i < N; ++i) {
+			if (sortedIds[i - 1] == sortedIds[i]) return false;
+		}
+		return true;
+	}
+
+	// Returns -1 if the ID isn't found
+	constexpr int32_t indexOf(clap_id paramId) const {
+		// Branchless binary search: the loop length only depends on `N`
+		size_t base = 0, length = N;
+		while (length > 1) {
+			size_t half = length/2;
+			base = (sortedIds[base + half] <= paramId) ? base + half : base;
+			length -= half;
+		}
+		return (sortedIds[base] == paramId) ? int32_t(sortedIndices[base]) : -1;
+	}
+
+private:
+	std::array<clap_id, N> sortedIds = {};
+	std::array<uint32_t, N> sortedIndices = {};
+
+	static constexpr void copyName(const char *from, char *to, size_t size) {
+		size_t i = 0;
+		for (; from[i] && i + 1 < size; ++i) to[i] = from[i];
+		for (; i < size; ++i) to[i] = 0;
+	}
+};
+template<size_t N>
+ParamTable(const ParamSpec (&)[N]) -> ParamTable<N>;
+
+/** Per-instance values for a `ParamTable`, which is the only per-instance state.
+
+This implements the methods for the CLAP parameters extension, but (unlike `ParamManager`) doesn't track UI changes or send events to the host.  The audio thread uses `values` directly, and `.paramsGetValue()` reads the copies published in a `ParamValueStore`.
+*/
+template<const auto &table>
+struct TableParams {
+	static_assert(table.uniqueIds(), "duplicate parameter IDs in ParamTable");
+	static constexpr size_t size = table.size();
+	std::array<double, size> values = table.defaults;
+
+	TableParams() {
+		published.resize(size);
+		publishAll();
+	}
+
+	double & operator[](size_t index) {
+		return values[index];
+	}
+	double operator[](size_t index) const {
+		return values[index];
+	}
+	
+	static constexpr int32_t indexOf(clap_id paramId) {
+		return table.indexOf(paramId);
+	}
+	
+	// Returns `true` if it was a known parameter
+	bool processEvent(const clap_event_header *event) {
+		if (event->space_id != CLAP_CORE_EVENT_SPACE_ID || event->type != CLAP_EVENT_PARAM_VALUE) return false;
+		auto &eventParam = *(const clap_event_param_value *)event;
+		int32_t index = indexOf(eventParam.param_id);
+		if (index < 0) return false;
+		values[index] = eventParam.value;
+		published.set(size_t(index), eventParam.value);
+		return true;
+	}
+	
+	void reset() {
+		values = table.defaults;
+		publishAll();
+	}
+	// Call after changing `values` other than through `.processEvent()`, from the thread which owns them (the audio thread while active)
+	void publishAll() {
+		for (size_t i = 0; i < size; ++i) published.set(i, values[i]);
+	}
+
+	uint32_t paramsCount() {
+		return uint32_t(size);
+	}
+	bool paramsGetInfo(uint32_t index, clap_param_info *info) {
+		if (index >= size) return false;
+		*info = table.infos[index];
+		return true;
+	}
+	bool paramsGetValue(clap_id paramId, double *value) {
+		int32_t index = indexOf(paramId);
+		if (index < 0) return false;
+		*value = published.get(size_t(index));
+		return true;
+	}
+	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
+		int32_t index = indexOf(paramId);
+		return index >= 0 && table.specs[index].format.toText(value, text, textCapacity);
+	}
+	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
+		int32_t index = indexOf(paramId);
+		if (index < 0 || !table.specs[index].format.fromText(text, value)) return false;
+		auto &spec = table.specs[index];
+		*value = std::max(spec.min, std::min(spec.max, *value));
+		return true;
+	}
+
+private:
+	ParamValueStore published;
+};
+
 }} // namespace
@@ -4,7 +4,11 @@
 
 #include <string>
 #include <vector>
-#include <unordered_set>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <algorithm>
 
 /* A template-based pattern for reading/writing state, inspired by the JSFX @serialize block
 
@@ -45,32 +49,244 @@ struct StorageDummy {
 	void markAtomic() {}
 };
 
+/** Opts a type in to single-pass (key-dispatch) reading, by promising that its `.state()` registers the same members every time, directly (not via local variables which are converted afterwards), with no conditional fields.
+
+Either add `static constexpr bool storageFixedKeys = true;` to the type, or specialise this:
+
+	template<>
+	struct signalsmith::storage::FixedStateKeys<MyClass> : std::true_type {};
+*/
+template<class Obj, typename=void>
+struct FixedStateKeys : std::false_type {};
+template<class Obj>
+struct FixedStateKeys<Obj, decltype(void(Obj::storageFixedKeys))> : std::integral_constant<bool, Obj::storageFixedKeys> {};
+
 // Template-y magic to call `obj.uiState()` only if it exists
 namespace _impl {
 	template<class Storage, class Obj>
 	void optionalUiStorage(Storage &storage, Obj &obj);
+
+	inline bool nativeLittleEndian() {
+		const uint16_t check = 1;
+		return *(const unsigned char *)&check;
+	}
+	// RFC 8746 typed-array tag for `T` in native byte order
+	template<class T>
+	unsigned typedArrayTag() {
+		static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "typed arrays are integers or floats");
+		constexpr unsigned sizeBits = (sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3);
+		unsigned tag = 64 + ((sizeof(T) > 1 && nativeLittleEndian()) ? 4 : 0);
+		if (std::is_floating_point<T>::value) {
+			tag += 16 + (sizeBits - 1); // 0 = float16, 1 = float32, 2 = float64
+		} else {
+			tag += (std::is_signed<T>::value ? 8 : 0) + sizeBits;
+		}
+		return tag;
+	}
 }
 
-struct DirtySet {
-	std::unordered_set<size_t> weakSet, strongSet;
+/** A read-only typed array (e.g. a wavetable) which can refer directly into the source CBOR, instead of copying it into a `std::vector`.
+
+When reading, this points into the CBOR bytes if they hold a typed array of exactly `T` in native byte order, aligned for `T` - so those bytes must outlive the view.  Anything else (misaligned, other endianness/type, or a plain array) is copied into internal storage.  When writing, it's written as a typed array.
+*/
+template<class T>
+struct TypedArrayView {
+	TypedArrayView() {}
+	TypedArrayView(const TypedArrayView &other) : pointer(other.pointer), length(other.length), isCopy(other.isCopy), copyStorage(other.copyStorage) {
+		if (isCopy) pointer = copyStorage.data();
+	}
+	TypedArrayView(TypedArrayView &&other) : pointer(other.pointer), length(other.length), isCopy(other.isCopy), copyStorage(std::move(other.copyStorage)) {
+		if (isCopy) pointer = copyStorage.data();
+		other.point(nullptr, 0);
+	}
+	TypedArrayView & operator=(TypedArrayView other) {
+		std::swap(copyStorage, other.copyStorage);
+		pointer = (other.isCopy ? copyStorage.data() : other.pointer);
+		length = other.length;
+		isCopy = other.isCopy;
+		return *this;
+	}
+
+	const T * data() const {
+		return pointer;
+	}
+	size_t size() const {
+		return length;
+	}
+	bool empty() const {
+		return !length;
+	}
+	const T & operator[](size_t i) const {
+		return pointer[i];
+	}
+	const T * begin() const {
+		return pointer;
+	}
+	const T * end() const {
+		return pointer + length;
+	}
+	// Whether this had to copy, instead of referring to the source
+	bool copied() const {
+		return isCopy;
+	}
 	
+	// Refers to existing memory, which must outlive the view
+	void point(const T *data, size_t size) {
+		pointer = data;
+		length = size;
+		isCopy = false;
+	}
+	// Fills the internal copy with `fn(std::vector<T> &)`, and refers to that
+	template<class Fn>
+	void copyFrom(Fn &&fn) {
+		fn(copyStorage);
+		pointer = copyStorage.data();
+		length = copyStorage.size();
+		isCopy = true;
+	}
+
+private:
+	const T *pointer = nullptr;
+	size_t length = 0;
+	bool isCopy = false;
+	std::vector<T> copyStorage;
+};
+
+/** The objects which have changed, for writing a patch (e.g. to a UI).
+
+Strong objects are written in full, weak ones only include their changed parts.  This is an open-addressed pointer set: clearing it just bumps an epoch, and adding never allocates unless it grows past `.reserve()`.
+*/
+struct DirtySet {
+	DirtySet(size_t capacity=64) {
+		reserve(capacity);
+	}
+
 	bool includes(void *obj) const {
-		size_t objAsInt = reinterpret_cast<size_t>(obj);
-		return strongSet.count(objAsInt) || weakSet.count(objAsInt);
+		return find(obj);
 	}
 	bool includesStrong(void *obj) const {
-		size_t objAsInt = reinterpret_cast<size_t>(obj);
-		return strongSet.count(objAsInt);
+		auto *slot = find(obj);
+		return slot && slot->strong;
 	}
 	
 	void addWeak(void *obj) {
-		size_t objAsInt = reinterpret_cast<size_t>(obj);
-		weakSet.insert(objAsInt);
+		insert(obj);
 	}
 	void addStrong(void *obj) {
-		size_t objAsInt = reinterpret_cast<size_t>(obj);
-		strongSet.insert(objAsInt);
+		insert(obj)->strong = true;
+	}
+
+	size_t size() const {
+		return count;
+	}
+	void clear() {
+		count = 0;
+		if (++epoch == 0) { // wrapped around, so old slots could look current
+			for (auto &slot : slots) slot.epoch = 0;
+			epoch = 1;
+		}
+	}
+	// Makes sure `count` objects can be added without allocating
+	void reserve(size_t objCount) {
+		size_t size = 16;
+		while (size < objCount*2) size *= 2;
+		if (size > slots.size()) rehash(size);
+	}
+
+private:
+	struct Slot {
+		uintptr_t key = 0;
+		uint32_t epoch = 0; // only valid if this matches the set's epoch
+		bool strong = false;
+	};
+	std::vector<Slot> slots;
+	size_t slotMask = 0, count = 0;
+	uint32_t epoch = 1;
+	
+	size_t indexFor(uintptr_t key) const {
+		uint64_t h = uint64_t(key)*0x9E3779B97F4A7C15ull; // Fibonacci hashing, since pointers are aligned
+		return size_t(h >> 32)&slotMask;
+	}
+	const Slot * find(void *obj) const {
+		auto key = reinterpret_cast<uintptr_t>(obj);
+		for (size_t i = indexFor(key);; i = (i + 1)&slotMask) {
+			auto &slot = slots[i];
+			if (slot.epoch != epoch) return nullptr;
+			if (slot.key == key) return &slot;
+		}
+	}
+	Slot * insert(void *obj) {
+		if ((count + 1)*2 > slots.size()) rehash(slots.size()*2);
+		auto key = reinterpret_cast<uintptr_t>(obj);
+		for (size_t i = indexFor(key);; i = (i + 1)&slotMask) {
+			auto &slot = slots[i];
+			if (slot.epoch != epoch) {
+				slot = {key, epoch, false};
+				++count;
+				return &slot;
+			}
+			if (slot.key == key) return &slot;
+		}
+	}
+	void rehash(size_t size) {
+		std::vector<Slot> old;
+		old.swap(slots);
+		slots.resize(size);
+		slotMask = size - 1;
+		count = 0;
+		for (auto &slot : old) {
+			if (slot.epoch == epoch) insert(reinterpret_cast<void *>(slot.key))->strong = slot.strong;
+		}
+	}
+};
+
+/** A reusable output buffer, which hands its bytes to `sink` whenever it fills up, so the whole document is never in memory at once.
+
+`.bytes` can back a `CborWriter`: call `.maybeFlush()` between values, and `.flush()` at the end.  For a CLAP stream, the sink can just call `writeAllToStream()`, which handles partial writes.
+*/
+struct StreamBuffer {
+	using Sink = std::function<bool(const void *, size_t)>;
+
+	std::vector<unsigned char> bytes;
+	size_t flushBytes;
+
+	StreamBuffer(Sink sink, size_t flushBytes=4096) : flushBytes(flushBytes), sink(std::move(sink)) {
+		bytes.reserve(flushBytes*2);
+	}
+	
+	bool maybeFlush() {
+		if (bytes.size() >= flushBytes) return flush();
+		return ok;
 	}
+	bool flush() {
+		if (ok && !bytes.empty()) {
+			ok = sink(bytes.data(), bytes.size());
+			totalBytes += bytes.size();
+		}
+		bytes.clear(); // keeps its capacity
+		return ok;
+	}
+	// Flushes, then passes a block of data straight to the sink without copying it
+	bool write(const void *data, size_t length) {
+		if (!flush() || !length) return ok;
+		ok = sink(data, length);
+		totalBytes += length;
+		return ok;
+	}
+
+	// `false` if the sink has failed (after which nothing more is written)
+	bool good() const {
+		return ok;
+	}
+	// Everything passed to the sink so far
+	size_t bytesWritten() const {
+		return totalBytes;
+	}
+
+private:
+	Sink sink;
+	bool ok = true;
+	size_t totalBytes = 0;
 };
 
 struct StorageCborWriter {
@@ -78,6 +294,10 @@ struct StorageCborWriter {
 		if (buffer) buffer->resize(0);
 	}
 	StorageCborWriter(std::vector<unsigned char> &cborBuffer, bool wantsExtra=false) : StorageCborWriter(signalsmith::cbor::CborWriter(cborBuffer), &cborBuffer, wantsExtra) {}
+	// Streams the output through a `StreamBuffer` - call `stream.flush()` when finished
+	StorageCborWriter(StreamBuffer &stream, bool wantsExtra=false, DirtySet *dirtySet=nullptr) : StorageCborWriter(signalsmith::cbor::CborWriter(stream.bytes), &stream.bytes, wantsExtra, dirtySet) {
+		this->stream = &stream;
+	}
 
 	template<class Obj>
 	void writeObject(Obj &obj) {
@@ -101,6 +321,7 @@ struct StorageCborWriter {
 		if (shouldSkip(value)) return;
 		cbor.addUtf8(key);
 		writeValue(value);
+		if (stream) stream->maybeFlush();
 	}
 
 	void extra(const char *key, const char *value) {
@@ -118,12 +339,14 @@ struct StorageCborWriter {
 		if (shouldSkip(value)) return;
 		cbor.addUtf8(key);
 		writeValue(value);
+		if (stream) stream->maybeFlush();
 	}
 
 	void markAtomic() {}
 
 private:
 	DirtySet *dirtySet;
+	StreamBuffer *stream = nullptr;
 
 	template<class V>
 	bool shouldSkip(V &value) {
@@ -170,18 +393,45 @@ private:
 				if (shouldSkip(item)) continue;
 				cbor.addInt(i);
 				writeValue(item);
+				if (stream) stream->maybeFlush();
 			}
 			cbor.close();
 		} else {
 			cbor.openArray(array.size());
 			for (auto &item : array) {
 				writeValue(item);
+				if (stream) stream->maybeFlush();
 			}
 		}
 	}
 
+	// Large typed arrays skip the buffer: we write the RFC 8746 tag and byte-string header ourselves, then pass the array's memory straight to the sink
+	template<class T>
+	bool streamTypedArray(const T *data, size_t size) {
+		size_t byteLength = size*sizeof(T);
+		if (!stream || byteLength < stream->flushBytes) return false;
+		if (!_impl::nativeLittleEndian() && sizeof(T) > 1) return false;
+
+		writeHead(6, _impl::typedArrayTag<T>());
+		writeHead(2, byteLength);
+		stream->write(data, byteLength);
+		return true;
+	}
+	void writeHead(unsigned majorType, uint64_t value) {
+		auto &bytes = stream->bytes;
+		unsigned char type = (unsigned char)(majorType << 5);
+		if (value < 24) {
+			bytes.push_back(type|(unsigned char)value);
+			return;
+		}
+		int byteCount = (value < 0x100) ? 1 : (value < 0x10000) ? 2 : (value < 0x100000000ull) ? 4 : 8;
+		bytes.push_back(type|(byteCount == 1 ? 24 : byteCount == 2 ? 25 : byteCount == 4 ? 26 : 27));
+		for (int i = byteCount - 1; i >= 0; --i) bytes.push_back((unsigned char)(value >> (i*8)));
+	}
+
 #define STORAGE_TYPED_ARRAY(T) \
 	void writeValue(std::vector<T> &array) { \
+		if (streamTypedArray(array.data(), array.size())) return; \
 		cbor.addTypedArray(array.data(), array.size()); \
 	}
 	STORAGE_TYPED_ARRAY(uint8_t)
@@ -196,21 +446,122 @@ private:
 	STORAGE_TYPED_ARRAY(double)
 #undef STORAGE_TYPED_ARRAY
 
+	template<class T>
+	void writeValue(TypedArrayView<T> &view) {
+		if (streamTypedArray(view.data(), view.size())) return;
+		cbor.addTypedArray(view.data(), view.size());
+	}
+
 	template<class Obj>
 	void writeValue(Obj &obj) {
 		writeObject(obj);
 	}
 };
 
+namespace _impl {
+	// Fields registered by an object's `.state()`, as offsets from the object, with an open-addressed hash table for the keys
+	template<class Reader>
+	struct KeyDispatch {
+		struct Field {
+			std::string key;
+			size_t offset;
+			void (*read)(Reader &, void *);
+		};
+		std::vector<Field> fields;
+		std::vector<size_t> slots; // index into `fields`, plus 1 (0 = empty)
+		size_t slotMask = 0, maxKeyLength = 0;
+		bool valid = true, atomic = false;
+		// Only used while building
+		const char *object = nullptr;
+		size_t objectSize = 0;
+
+		template<class V>
+		void add(const char *key, V &value) {
+			auto *bytes = (const char *)&value;
+			if (bytes < object || bytes + sizeof(V) > object + objectSize) {
+				valid = false;
+				return;
+			}
+			fields.push_back({key, size_t(bytes - object), &readField<V>});
+		}
+		void build() {
+			size_t size = 4;
+			while (size < fields.size()*2) size *= 2;
+			slots.assign(size, 0);
+			slotMask = size - 1;
+			for (size_t i = 0; i < fields.size(); ++i) {
+				auto &key = fields[i].key;
+				maxKeyLength = std::max(maxKeyLength, key.size());
+				if (find(key.data(), key.size())) continue; // the first registration wins, like the multi-pass reader
+				size_t slot = hash(key.data(), key.size())&slotMask;
+				while (slots[slot]) slot = (slot + 1)&slotMask;
+				slots[slot] = i + 1;
+			}
+			object = nullptr;
+		}
+		const Field * find(const char *key, size_t length) const {
+			size_t slot = hash(key, length)&slotMask;
+			while (size_t index = slots[slot]) {
+				auto &field = fields[index - 1];
+				if (field.key.size() == length && !std::memcmp(field.key.data(), key, length)) return &field;
+				slot = (slot + 1)&slotMask;
+			}
+			return nullptr;
+		}
+		static size_t hash(const char *key, size_t length) {
+			uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+			for (size_t i = 0; i < length; ++i) h = (h^uint8_t(key[i]))*0x100000001b3ull;
+			return size_t(h^(h >> 32));
+		}
+
+		template<class V>
+		static void readField(Reader &reader, void *field) {
+			reader.readValue(*(V *)field);
+		}
+
+		// Built from the first object we see (with `reader` in collecting mode), then shared (thread-safe static initialisation).  Only for types which opt in with `FixedStateKeys`, since other instances might register different fields.
+		template<class Obj, bool withExtra>
+		static const KeyDispatch & forType(Reader &reader, Obj &obj, KeyDispatch *&collecting) {
+			static const KeyDispatch dispatch = [&](){
+				KeyDispatch d;
+				if (!FixedStateKeys<Obj>::value || std::is_polymorphic<Obj>::value) {
+					d.valid = false;
+					return d;
+				}
+				d.object = (const char *)&obj;
+				d.objectSize = sizeof(Obj);
+				auto *prevCollecting = collecting;
+				collecting = &d;
+				obj.state(reader);
+				if (withExtra) optionalUiStorage(reader, obj);
+				collecting = prevCollecting;
+				d.build();
+				return d;
+			}();
+			return dispatch;
+		}
+	};
+}
+
 struct StorageCborReader {
 	using Cbor = signalsmith::cbor::TaggedCborWalker;
 	
 	StorageCborReader(Cbor c, bool wantsExtra=false, DirtySet *dirtySet=nullptr) : cbor(c), wantsExtra(wantsExtra), dirtySet(dirtySet) {}
 	StorageCborReader(const std::vector<unsigned char> &v, bool wantsExtra=false, DirtySet *dirtySet=nullptr) : StorageCborReader(Cbor(v), wantsExtra, dirtySet) {}
 
+	/* Reads each map in a single pass, using a key->field table built from one `.state()` call and cached per type.
+
+	This only applies to types which opt in with `FixedStateKeys`.  Other types (and any with fields outside the object, or a virtual `.state()`) fall back to the default, which calls `.state()` once per key.
+	*/
+	bool keyDispatch = false;
+
 	template<class Obj>
 	bool readObject(Obj &obj) {
 		if (!cbor.isMap()) return false;
+		if (keyDispatch) {
+			auto &dispatch = wantsExtra ? keyDispatchFor<Obj, true>(obj) : keyDispatchFor<Obj, false>(obj);
+			if (dispatch.valid) return readObjectDispatch(obj, dispatch);
+		}
 		
 		bool childMarkedAtomic = false;
 		void *co = currentObj;
@@ -248,6 +599,7 @@ struct StorageCborReader {
 	
 	template<class V>
 	void operator()(const char *key, V &v) {
+		if (collecting) return collecting->add(key, v);
 		if (filterKeyBytes != nullptr) {
 			if (!keyMatch(key, filterKeyBytes, filterKeyLength)) return;
 		}
@@ -264,6 +616,10 @@ struct StorageCborReader {
 	void extra(const char *key, const V &v) {}
 
 	void markAtomic() {
+		if (collecting) {
+			collecting->atomic = true;
+			return;
+		}
 		containsMarkAtomic = true;
 		if (dirtySet) dirtySet->addStrong(currentObj);
 	}
@@ -278,6 +634,48 @@ private:
 	const char *filterKeyBytes = nullptr;
 	size_t filterKeyLength = 0;
 
+	using KeyDispatch = _impl::KeyDispatch<StorageCborReader>;
+	KeyDispatch *collecting = nullptr;
+	friend KeyDispatch;
+	friend struct StorageCborStreamReader;
+
+	template<class Obj, bool withExtra>
+	const KeyDispatch & keyDispatchFor(Obj &obj) {
+		return KeyDispatch::template forType<Obj, withExtra>(*this, obj, collecting);
+	}
+
+	template<class Obj>
+	bool readObjectDispatch(Obj &obj, const KeyDispatch &dispatch) {
+		bool childMarkedAtomic = false;
+		void *co = currentObj;
+		currentObj = &obj;
+		const char *fkb = filterKeyBytes;
+		filterKeyBytes = nullptr;
+
+		bool anyKeys = false;
+		cbor = cbor.forEachPair([&](Cbor key, Cbor value){
+			if (!key.isUtf8()) return;
+			anyKeys = true;
+			auto *field = dispatch.find((const char *)key.bytes(), key.length());
+			if (!field) return;
+			containsMarkAtomic = false;
+			cbor = value;
+			field->read(*this, (char *)&obj + field->offset);
+			if (containsMarkAtomic) childMarkedAtomic = true;
+		});
+		// The multi-pass reader calls `.state()` (and therefore `.markAtomic()`) once for every string key
+		if (anyKeys && dispatch.atomic) {
+			markAtomic();
+			childMarkedAtomic = true;
+		}
+
+		filterKeyBytes = fkb;
+		currentObj = co;
+		containsMarkAtomic = childMarkedAtomic;
+		if (containsMarkAtomic && dirtySet) dirtySet->addWeak(&obj);
+		return true;
+	}
+
 	template<class Obj>
 	void readValue(Obj &obj) {
 		readObject(obj);
@@ -394,6 +792,22 @@ private:
 	STORAGE_TYPED_ARRAY(double)
 #undef STORAGE_TYPED_ARRAY
 
+	template<class T>
+	void readValue(TypedArrayView<T> &view) {
+		if (cbor.isTypedArray() && cbor.typedArrayTag() == _impl::typedArrayTag<T>()) {
+			auto *bytes = cbor.bytes();
+			if (size_t(bytes)%alignof(T) == 0) {
+				view.point((const T *)bytes, cbor.typedArrayLength());
+				return;
+			}
+		}
+		bool patch = cbor.isMap() && !view.copied(); // the internal copy isn't current, so fill it before patching
+		view.copyFrom([&](std::vector<T> &array){
+			if (patch) array.assign(view.begin(), view.end());
+			readValue(array);
+		});
+	}
+
 	static bool keyMatch(const char *key, const char *filterKeyBytes, size_t filterKeyLength) {
 		for (size_t i = 0; i < filterKeyLength; ++i) {
 			if (key[i] != filterKeyBytes[i]) return false;
@@ -402,6 +816,459 @@ private:
 	}
 };
 
+/** Reads from a source (e.g. a `clap_istream`) through a fixed-size window, so the whole document never has to be in memory.
+
+Large blocks are read straight from the source into their destination.  The source returns the number of bytes read, 0 at the end of the stream, or a negative number for an error.
+*/
+struct StreamSource {
+	using Source = std::function<int64_t(void *, size_t)>;
+
+	StreamSource(Source source, size_t windowBytes=4096) : window(windowBytes), source(std::move(source)) {}
+
+	// Makes sure at least `bytes` (no more than the window size) are available, unless the stream ends first
+	bool fill(size_t bytes) {
+		if (end - start >= bytes) return true;
+		if (bytes > window.size()) return false;
+		if (start + bytes > window.size()) {
+			std::memmove(window.data(), window.data() + start, end - start);
+			end -= start;
+			start = 0;
+		}
+		while (end - start < bytes && !finished) {
+			int64_t result = source(window.data() + end, window.size() - end);
+			if (result <= 0) {
+				finished = true;
+				ok = (result == 0);
+			} else {
+				end += size_t(result);
+			}
+		}
+		return end - start >= bytes;
+	}
+	const unsigned char * data() const {
+		return window.data() + start;
+	}
+	size_t available() const {
+		return end - start;
+	}
+	void consume(size_t bytes) {
+		start += bytes;
+		totalBytes += bytes;
+		if (start == end) start = end = 0;
+	}
+
+	// Copies whatever's in the window, then reads the rest directly from the source if it's big enough
+	bool read(void *dest, size_t bytes) {
+		auto *out = (unsigned char *)dest;
+		while (bytes) {
+			if (!available() && bytes >= window.size()) {
+				if (finished) return false;
+				int64_t result = source(out, bytes);
+				if (result <= 0) {
+					finished = true;
+					ok = (result == 0);
+					return false;
+				}
+				out += result;
+				bytes -= size_t(result);
+				totalBytes += size_t(result);
+				continue;
+			}
+			if (!fill(1)) return false;
+			size_t chunk = std::min(bytes, available());
+			std::memcpy(out, data(), chunk);
+			consume(chunk);
+			out += chunk;
+			bytes -= chunk;
+		}
+		return true;
+	}
+	bool skip(size_t bytes) {
+		while (bytes) {
+			if (!fill(1)) return false;
+			size_t chunk = std::min(bytes, available());
+			consume(chunk);
+			bytes -= chunk;
+		}
+		return true;
+	}
+
+	// `false` if the source reported an error
+	bool good() const {
+		return ok;
+	}
+	// Everything consumed so far
+	size_t bytesRead() const {
+		return totalBytes;
+	}
+
+private:
+	std::vector<unsigned char> window;
+	size_t start = 0, end = 0;
+	Source source;
+	bool ok = true, finished = false;
+	size_t totalBytes = 0;
+};
+
+/** Reads state straight from a `StreamSource`, instead of needing the whole document in memory first.
+
+Objects which opt in with `FixedStateKeys` are read in a single pass, using the same per-type key table as `StorageCborReader::keyDispatch`, numbers, bools and strings are decoded straight from the window, and typed arrays are read directly into their `std::vector`'s storage.  Anything else (including types which can't use key dispatch) is copied out on its own and read by a `StorageCborReader`, so the results are the same.
+
+This is for loading state, so there's no `DirtySet` or `.uiState()`.
+*/
+struct StorageCborStreamReader {
+	StorageCborStreamReader(StreamSource &source) : source(source) {}
+
+	// Arrays and strings are allocated up-front from their CBOR length, up to this many bytes - past that, they grow as data arrives, so a truncated or corrupt stream fails before allocating much more than it contains.  Keys longer than any known field are skipped without being stored.
+	size_t maxSizeHint = 64 << 20;
+
+	// Returns `false` if the next value isn't a map, or the stream ended early
+	template<class Obj>
+	bool readObject(Obj &obj) {
+		Head head;
+		if (!peekHead(head) || head.major != 5) return false;
+		auto &dispatch = KeyDispatch::template forType<Obj, false>(*this, obj, collecting);
+		if (!dispatch.valid) {
+			return delegate([&](StorageCborReader &reader){
+				reader.readObject(obj);
+			});
+		}
+		source.consume(head.size);
+		for (uint64_t i = 0; head.indefinite || i < head.arg; ++i) {
+			if (head.indefinite && atBreak()) break;
+			Head key;
+			if (!peekHead(key)) return fail();
+			const typename KeyDispatch::Field *field = nullptr;
+			if (key.major == 3 && !key.indefinite && key.arg <= dispatch.maxKeyLength) {
+				source.consume(key.size);
+				keyBytes.resize(size_t(key.arg));
+				if (!source.read(&keyBytes[0], keyBytes.size())) return fail();
+				field = dispatch.find(keyBytes.data(), keyBytes.size());
+			} else if (!transfer(nullptr)) {
+				return fail();
+			}
+			if (field) {
+				field->read(*this, (char *)&obj + field->offset);
+			} else if (!transfer(nullptr)) {
+				return fail();
+			}
+			if (!ok) return false;
+		}
+		return ok;
+	}
+
+	template<class V>
+	void operator()(const char *key, V &v) {
+		if (collecting) collecting->add(key, v);
+	}
+
+	template<class V>
+	void extra(const char *key, const V &v) {}
+
+	void markAtomic() {
+		if (collecting) collecting->atomic = true;
+	}
+
+private:
+	StreamSource &source;
+	bool ok = true;
+	std::string keyBytes;
+	std::vector<unsigned char> scratch;
+
+	using KeyDispatch = _impl::KeyDispatch<StorageCborStreamReader>;
+	KeyDispatch *collecting = nullptr;
+	friend KeyDispatch;
+
+	struct Head {
+		unsigned major = 0, minor = 0;
+		uint64_t arg = 0;
+		size_t size = 0;
+		bool indefinite = false;
+	};
+	// Parses a CBOR head (type and argument), without consuming it
+	bool peekHead(Head &head, size_t offset=0) {
+		if (!source.fill(offset + 1)) return false;
+		unsigned char initial = source.data()[offset];
+		head.major = initial >> 5;
+		head.minor = initial&31;
+		if (head.minor >= 28 && head.minor < 31) return false; // reserved
+		head.indefinite = (head.minor == 31);
+		size_t extra = (head.minor >= 24 && head.minor < 28) ? (size_t(1) << (head.minor - 24)) : 0;
+		head.size = 1 + extra;
+		if (!source.fill(offset + head.size)) return false;
+		head.arg = (head.minor < 24) ? head.minor : 0;
+		for (size_t i = 0; i < extra; ++i) head.arg = (head.arg << 8)|source.data()[offset + 1 + i];
+		return true;
+	}
+	bool atBreak() {
+		if (!source.fill(1)) return fail();
+		if (source.data()[0] != 0xFF) return false;
+		source.consume(1);
+		return true;
+	}
+	bool fail() {
+		ok = false;
+		return false;
+	}
+	// CBOR lengths are 64-bit, which might not fit in `size_t`
+	static bool fitsSize(uint64_t length) {
+		return length <= uint64_t(SIZE_MAX);
+	}
+	// Reads `length` bytes onto the end of `out`, growing it (past `maxSizeHint`) only as the data arrives
+	template<class Bytes>
+	bool readBytes(Bytes &out, size_t length) {
+		size_t index = out.size(), done = 0;
+		while (done < length) {
+			size_t limit = std::max(std::max(done, maxSizeHint), size_t(1));
+			size_t chunk = std::min(length - done, limit);
+			out.resize(index + done + chunk);
+			if (!source.read(&out[index + done], chunk)) return false;
+			done += chunk;
+		}
+		return true;
+	}
+
+	// Copies (or skips, if `out` is null) one complete value
+	bool transfer(std::vector<unsigned char> *out) {
+		Head head;
+		if (!peekHead(head)) return false;
+		if (out) out->insert(out->end(), source.data(), source.data() + head.size);
+		source.consume(head.size);
+		if (head.major == 2 || head.major == 3 || head.major == 4 || head.major == 5) {
+			if (head.indefinite) {
+				while (1) {
+					if (!source.fill(1)) return false;
+					if (source.data()[0] == 0xFF) {
+						if (out) out->push_back(0xFF);
+						source.consume(1);
+						return true;
+					}
+					if (!transfer(out)) return false;
+				}
+			} else if (head.major <= 3) {
+				if (!fitsSize(head.arg)) return false;
+				if (!out) return source.skip(size_t(head.arg));
+				return readBytes(*out, size_t(head.arg));
+			}
+			uint64_t items = head.arg*(head.major == 5 ? 2 : 1);
+			for (uint64_t i = 0; i < items; ++i) {
+				if (!transfer(out)) return false;
+			}
+			return true;
+		} else if (head.major == 6) {
+			return transfer(out); // tagged value
+		}
+		return !head.indefinite; // a "break" isn't a value
+	}
+	
+	// Copies the next value out, and reads it with a `StorageCborReader`
+	template<class Fn>
+	bool delegate(Fn &&fn) {
+		scratch.clear();
+		if (!transfer(&scratch)) return fail();
+		StorageCborReader reader(scratch);
+		reader.keyDispatch = true;
+		fn(reader);
+		return true;
+	}
+	
+	template<class Obj>
+	void readValue(Obj &obj) {
+		Head head;
+		if (!peekHead(head)) {
+			fail();
+		} else if (head.major == 5) {
+			readObject(obj);
+		} else if (!transfer(nullptr)) { // not an object, so ignored
+			fail();
+		}
+	}
+
+	// Scalars are decoded straight from the window when the CBOR type is the obvious one.  Anything else (tags, `null`, half-floats, indefinite strings) is delegated, so the results still match `StorageCborReader`.
+	template<class V>
+	void readScalar(V &v) {
+		delegate([&](StorageCborReader &reader){
+			reader.readValue(v);
+		});
+	}
+	// Returns `false` (without consuming anything) if the next value isn't a plain integer
+	template<class V>
+	bool readInt(V &v) {
+		Head head;
+		if (!peekHead(head) || head.indefinite) return false;
+		if (head.major == 0) {
+			v = V(head.arg);
+		} else if (head.major == 1 && head.arg <= uint64_t(INT64_MAX)) {
+			v = V(-1 - int64_t(head.arg));
+		} else {
+			return false;
+		}
+		source.consume(head.size);
+		return true;
+	}
+
+#define STORAGE_INT_TYPE(V) \
+	void readValue(V &v) { \
+		if (!readInt(v)) readScalar(v); \
+	}
+	STORAGE_INT_TYPE(int64_t)
+	STORAGE_INT_TYPE(uint64_t)
+	STORAGE_INT_TYPE(int32_t)
+	STORAGE_INT_TYPE(uint32_t)
+	STORAGE_INT_TYPE(int16_t)
+	STORAGE_INT_TYPE(uint16_t)
+	STORAGE_INT_TYPE(int8_t)
+	STORAGE_INT_TYPE(uint8_t)
+#undef STORAGE_INT_TYPE
+
+	template<class V>
+	void readFloat(V &v) {
+		Head head;
+		if (!peekHead(head)) {
+			fail();
+		} else if (head.major == 7 && head.minor == 26) {
+			uint32_t bits = uint32_t(head.arg);
+			float f;
+			std::memcpy(&f, &bits, sizeof(f));
+			v = V(f);
+			source.consume(head.size);
+		} else if (head.major == 7 && head.minor == 27) {
+			double d;
+			std::memcpy(&d, &head.arg, sizeof(d));
+			v = V(d);
+			source.consume(head.size);
+		} else if (!readInt(v)) {
+			readScalar(v);
+		}
+	}
+	void readValue(float &v) {
+		readFloat(v);
+	}
+	void readValue(double &v) {
+		readFloat(v);
+	}
+	void readValue(bool &v) {
+		Head head;
+		if (!peekHead(head)) {
+			fail();
+		} else if (head.major == 7 && (head.minor == 20 || head.minor == 21)) {
+			v = (head.minor == 21);
+			source.consume(head.size);
+		} else {
+			readScalar(v);
+		}
+	}
+	void readValue(std::string &v) {
+		Head head;
+		if (!peekHead(head)) {
+			fail();
+		} else if (head.major == 3 && !head.indefinite) {
+			source.consume(head.size);
+			v.clear();
+			if (!fitsSize(head.arg) || !readBytes(v, size_t(head.arg))) fail();
+		} else if (head.major == 3 || head.major == 6) {
+			readScalar(v);
+		} else {
+			v.clear(); // sometimes `null` or similar
+			if (!transfer(nullptr)) fail();
+		}
+	}
+
+	template<class Item>
+	void readVector(std::vector<Item> &array) {
+		Head head;
+		if (!peekHead(head)) {
+			fail();
+			return;
+		}
+		if (head.major != 4) {
+			// Patches (maps) and anything unexpected go through the in-memory reader
+			delegate([&](StorageCborReader &reader){
+				reader.readValue(array);
+			});
+			return;
+		}
+		source.consume(head.size);
+		if (head.indefinite) {
+			size_t length = 0;
+			while (ok && !atBreak()) {
+				if (array.size() <= length) array.emplace_back();
+				readValue(array[length++]);
+			}
+			array.resize(length);
+		} else {
+			if (!fitsSize(head.arg)) {
+				fail();
+				return;
+			}
+			size_t length = size_t(head.arg);
+			size_t hint = std::min(length, maxSizeHint/sizeof(Item) + 1); // the CBOR length is a size hint
+			if (array.size() < hint) array.resize(hint);
+			for (size_t i = 0; ok && i < length; ++i) {
+				if (array.size() <= i) array.emplace_back();
+				readValue(array[i]);
+			}
+			if (ok) array.resize(length);
+		}
+	}
+	template<class Item>
+	void readValue(std::vector<Item> &array) {
+		readVector(array);
+	}
+
+	// Typed arrays which exactly match `T` (RFC 8746, native byte order) are read directly into the vector, everything else falls back
+	template<class T>
+	void readTypedArray(std::vector<T> &array) {
+		Head head, bytesHead;
+		if (peekHead(head) && head.major == 6 && head.arg == _impl::typedArrayTag<T>() && peekHead(bytesHead, head.size)) {
+			if (bytesHead.major == 2 && !bytesHead.indefinite && bytesHead.arg%sizeof(T) == 0 && fitsSize(bytesHead.arg)) {
+				source.consume(head.size + bytesHead.size);
+				size_t length = size_t(bytesHead.arg/sizeof(T)), done = 0;
+				array.resize(std::min(length, maxSizeHint/sizeof(T) + 1));
+				while (done < length) {
+					// Past the size hint, grow geometrically as the data actually arrives
+					if (array.size() == done) array.resize(std::min(length, done*2));
+					size_t chunk = array.size() - done;
+					if (!source.read(array.data() + done, chunk*sizeof(T))) {
+						fail();
+						return;
+					}
+					done += chunk;
+				}
+				return;
+			}
+		}
+		readVector(array);
+	}
+
+#define STORAGE_TYPED_ARRAY(T) \
+	void readValue(std::vector<T> &array) { \
+		readTypedArray(array); \
+	}
+	STORAGE_TYPED_ARRAY(uint8_t)
+	STORAGE_TYPED_ARRAY(int8_t)
+	STORAGE_TYPED_ARRAY(uint16_t)
+	STORAGE_TYPED_ARRAY(int16_t)
+	STORAGE_TYPED_ARRAY(uint32_t)
+	STORAGE_TYPED_ARRAY(int32_t)
+	STORAGE_TYPED_ARRAY(uint64_t)
+	STORAGE_TYPED_ARRAY(int64_t)
+	STORAGE_TYPED_ARRAY(float)
+	STORAGE_TYPED_ARRAY(double)
+#undef STORAGE_TYPED_ARRAY
+
+	// There's nothing persistent to point into, so views always copy
+	template<class T>
+	void readValue(TypedArrayView<T> &view) {
+		Head head;
+		bool patch = peekHead(head) && head.major == 5 && !view.copied();
+		view.copyFrom([&](std::vector<T> &array){
+			if (patch) array.assign(view.begin(), view.end());
+			readTypedArray(array);
+		});
+	}
+};
+
 namespace _impl {
 
 	template<class Storage, class Obj, typename=void>
@@ -6,6 +6,8 @@
 #include "clap/clap.h"
 
 #include "signalsmith-clap/cpp.h"
+#include "signalsmith-clap/params.h"
+#include "signalsmith-clap/storage.h"
 
 #include "signalsmith-basics/chorus.h"
 #include "cbor-walker/cbor-walker.h"
@@ -52,93 +54,23 @@ struct ExampleAudioPlugin {
 
 	signalsmith::basics::ChorusFloat chorus;
 
-	struct Param {
-		double value = 0;
-		clap_param_info info;
-		const char *formatString = "%.2f";
-		
-		// User interactions which we need to send as events to the host
-		std::atomic_flag sentValue = ATOMIC_FLAG_INIT;
-		std::atomic_flag sentGestureStart = ATOMIC_FLAG_INIT;
-		std::atomic_flag sentGestureEnd =ATOMIC_FLAG_INIT;
-
-		std::atomic_flag sentUiState = ATOMIC_FLAG_INIT;
-
-		Param(const char *name, clap_id paramId, double min, double initial, double max) : value(initial) {
-			info = {
-				.id=paramId,
-				.flags=CLAP_PARAM_IS_AUTOMATABLE,
-				.cookie=this,
-				.name={}, // assigned below
-				.module={},
-				.min_value=min,
-				.max_value=max,
-				.default_value=initial
-			};
-			std::strncpy(info.name, name, CLAP_NAME_SIZE);
-			
-			sentValue.test_and_set();
-			sentGestureStart.test_and_set();
-			sentGestureEnd.test_and_set();
-		}
-
-		void sendEvents(const clap_output_events *outEvents) {
-			if (!sentGestureStart.test_and_set()) {
-				clap_event_param_gesture event{
-					.header={
-						.size=sizeof(clap_event_param_gesture),
-						.time=0,
-						.space_id=CLAP_CORE_EVENT_SPACE_ID,
-						.type=CLAP_EVENT_PARAM_GESTURE_BEGIN,
-						.flags=CLAP_EVENT_IS_LIVE
-					},
-					.param_id=info.id
-				};
-				outEvents->try_push(outEvents, &event.header);
-			}
-			if (!sentValue.test_and_set()) {
-				clap_event_param_value event{
-					.header={
-						.size=sizeof(clap_event_param_value),
-						.time=0,
-						.space_id=CLAP_CORE_EVENT_SPACE_ID,
-						.type=CLAP_EVENT_PARAM_VALUE,
-						.flags=CLAP_EVENT_IS_LIVE
-					},
-					.param_id=info.id,
-					.cookie=this,
-					.note_id=-1,
-					.port_index=-1,
-					.channel=-1,
-					.key=-1,
-					.value=value
-				};
-				outEvents->try_push(outEvents, &event.header);
-			}
-			if (!sentGestureEnd.test_and_set()) {
-				clap_event_param_gesture event{
-					.header={
-						.size=sizeof(clap_event_param_gesture),
-						.time=0,
-						.space_id=CLAP_CORE_EVENT_SPACE_ID,
-						.type=CLAP_EVENT_PARAM_GESTURE_END,
-						.flags=CLAP_EVENT_IS_LIVE
-					},
-					.param_id=info.id
-				};
-				outEvents->try_push(outEvents, &event.header);
-			}
-		}
-	};
-	Param mix{"mix", 0xCA5CADE5, 0, 0.6, 1};
-	Param depthMs{"depth", 0xBA55FEED, 2, 15, 50};
-	Param detune{"detune", 0xCA55E77E, 1, 6, 30};
-	Param stereo{"stereo", 0x0FF51DE5, 0, 1, 2};
+	using Param = signalsmith::clap::Param;
+	Param mix{"mix", "mix", 0xCA5CADE5, 0, 0.6, 1};
+	Param depthMs{"depth", "depth", 0xBA55FEED, 2, 15, 50};
+	Param detune{"detune", "detune", 0xCA55E77E, 1, 6, 30};
+	Param stereo{"stereo", "stereo", 0x0FF51DE5, 0, 1, 2};
 	std::array<Param *, 4> params = {&mix, &depthMs, &detune, &stereo};
+	signalsmith::clap::ParamIndex<> paramIndex;
+	signalsmith::clap::ParamValueStore paramValues; // readable from the main/UI threads
+	signalsmith::clap::ParamChangeQueue uiChanges; // UI thread -> audio thread
+	std::atomic_flag flushRequested = ATOMIC_FLAG_INIT;
+	bool active = false; // only used on the main thread
 	
 	ExampleAudioPlugin(const clap_host *host) : host(host) {
-		depthMs.formatString = "%.1f ms";
-		detune.formatString = "%.0f cents";
+		paramIndex.build(params);
+		paramValues.attach(params);
+		depthMs.format = signalsmith::clap::ParamFormat::ms(1);
+		detune.format = signalsmith::clap::ParamFormat::cents(0);
 	}
 
 	// Makes a C function pointer to a C++ method
@@ -175,9 +107,11 @@ struct ExampleAudioPlugin {
 	}
 	bool pluginActivate(double sRate, uint32_t minFrames, uint32_t maxFrames) {
 		chorus.configure(sRate, maxFrames, 2);
+		active = true;
 		return true;
 	}
 	void pluginDeactivate() {
+		active = false;
 	}
 	bool pluginStartProcessing() {
 		return true;
@@ -193,17 +127,12 @@ struct ExampleAudioPlugin {
 			auto &eventParam = *(const clap_event_param_value *)event;
 			if (eventParam.cookie) {
 				// if provided, it's the parameter
-				auto &param = *(Param *)eventParam.cookie;
-				param.value = eventParam.value;
-				param.sentUiState.clear();
+				auto *param = (Param *)eventParam.cookie;
+				param->setValueFromEvent(eventParam);
 			} else {
 				// Otherwise, match the ID
-				for (auto *param : params) {
-					if (eventParam.param_id == param->info.id) {
-						param->value = eventParam.value;
-						param->sentUiState.clear();
-						break;
-					}
+				if (auto *param = paramIndex.find(eventParam.param_id)) {
+					param->setValueFromEvent(eventParam);
 				}
 			}
 
@@ -220,6 +149,7 @@ struct ExampleAudioPlugin {
 
 		auto *eventsIn = process->in_events;
 		auto *eventsOut = process->out_events;
+		drainUiChanges(eventsOut);
 		uint32_t eventCount = eventsIn->size(eventsIn);
 		// We could (should?) split the processing up and apply these events partway through the block
 		// but for simplicity here we don't support sample-accurate automation
@@ -300,14 +230,20 @@ struct ExampleAudioPlugin {
 	// ---- state save/load ----
 	
 	bool stateSave(const clap_ostream_t *stream) {
-		std::vector<unsigned char> bytes;
-		signalsmith::cbor::CborWriter cbor{bytes};
+		// Passed to the host in `flushBytes`-sized pieces as it's written, rather than building the whole state first
+		signalsmith::storage::StreamBuffer out([&](const void *data, size_t length){
+			return signalsmith::clap::writeAllToStream(data, length, stream);
+		});
+		signalsmith::cbor::CborWriter cbor{out.bytes};
+		std::vector<double> values;
+		paramValues.snapshot(values); // the audio thread might be changing them
 		cbor.openMap(4);
-		for (auto *param : params) {
-			cbor.addInt(param->info.id); // CBOR keys can be any type
-			cbor.addFloat(param->value);
+		for (size_t i = 0; i < params.size(); ++i) {
+			cbor.addInt(params[i]->info.id); // CBOR keys can be any type
+			cbor.addFloat(values[i]);
+			out.maybeFlush();
 		}
-		return signalsmith::clap::writeAllToStream(bytes, stream);
+		return out.flush();
 	}
 	bool stateLoad(const clap_istream_t *stream) {
 		std::vector<unsigned char> bytes;
@@ -316,14 +252,23 @@ struct ExampleAudioPlugin {
 		using Cbor = signalsmith::cbor::CborWalker;
 		Cbor cbor{bytes};
 		if (!cbor.isMap()) return false;
+		bool queued = true;
 		cbor.forEachPair([&](Cbor key, Cbor value){
-			for (auto *param : params) {
-				if (uint32_t(key) == param->info.id) {
+			if (auto *param = paramIndex.find(uint32_t(key))) {
+				if (active) {
+					// The audio thread owns the values while we're active
+					queued = uiChanges.load(*param, double(value)) && queued;
+				} else {
 					param->value = double(value);
+					param->publishValue();
+					param->sentUiState.clear();
 				}
 			}
 		});
-		return true;
+		if (active && hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
+		sentWebviewState.clear();
+		host->request_callback(host);
+		return queued;
 	}
 
 	// ---- audio ports ----
@@ -357,27 +302,20 @@ struct ExampleAudioPlugin {
 	}
 	
 	bool paramsGetValue(clap_id paramId, double *value) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				*value = param->value;
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		if (!param) return false;
+		*value = param->publishedValue();
+		return true;
 	}
 	
 	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				std::snprintf(text, textCapacity, param->formatString, value);
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		return param && param->valueToText(value, text, textCapacity);
 	}
 
 	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
-		return false; // not supported
+		auto *param = paramIndex.find(paramId);
+		return param && param->textToValue(text, value); // clamped to the range
 	}
 	
 	void paramsFlush(const clap_input_events *eventsIn, const clap_output_events *eventsOut) {
@@ -387,10 +325,21 @@ struct ExampleAudioPlugin {
 			processEvent(event);
 			eventsOut->try_push(eventsOut, event);
 		}
+		drainUiChanges(eventsOut);
+		uiChanges.flushWaiting(eventsOut);
 		for (auto *param : params) {
 			param->sendEvents(eventsOut);
 		}
 	}
+	// Applies changes from the UI (or from loading state), and sends them to the host
+	void drainUiChanges(const clap_output_events *eventsOut) {
+		flushRequested.clear();
+		uiChanges.drain(eventsOut);
+		if (uiChanges.takeLoaded()) {
+			sentWebviewState.clear();
+			host->request_callback(host);
+		}
+	}
 
 	// ---- GUI ----
 	
@@ -488,13 +437,12 @@ struct ExampleAudioPlugin {
 			cbor.forEachPair([&](Cbor key, Cbor value){
 				auto keyString = key.utf8View();
 				if (keyString == "value" && value.isNumber()) {
-					param.value = value;
-					param.sentValue.clear();
+					uiChanges.value(param, double(value));
 				} else if (keyString == "gesture") {
 					if (bool(value)) {
-						param.sentGestureStart.clear();
+						uiChanges.gestureStart(param);
 					} else {
-						param.sentGestureEnd.clear();
+						uiChanges.gestureEnd(param);
 					}
 				}
 			});
@@ -524,7 +472,8 @@ struct ExampleAudioPlugin {
 			}
 		});
 
-		if (hostParams) hostParams->request_flush(host);
+		// Coalesce flush requests until the next time we send the events
+		if (hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
 
 		return !cbor.error();
 	}
@@ -541,7 +490,7 @@ struct ExampleAudioPlugin {
 			cbor.addUtf8(key);
 			cbor.openMap(1);
 			cbor.addUtf8("value");
-			cbor.addFloat(param.value);
+			cbor.addFloat(param.publishedValue());
 		};
 		updateParam("mix", mix);
 		updateParam("depth", depthMs);
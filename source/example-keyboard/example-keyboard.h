@@ -3,6 +3,7 @@
 #include "signalsmith-clap/cpp.h"
 #include "signalsmith-clap/note-manager.h"
 #include "signalsmith-clap/params.h"
+#include "signalsmith-clap/storage.h"
 
 #include "cbor-walker/cbor-walker.h"
 #include "webview-gui/clap-webview-gui.h"
@@ -58,13 +59,16 @@ struct ExampleKeyboard {
 	Param regularity{"regularity", "regularity", 0x02468ACE, 0.0, 0.5, 1.0};
 	Param velocityRand{"velocityRand", "velocity rand.", 0x12345678, 0.0, 0.5, 1.0};
 	std::array<Param *, 3> params{&log2Rate, &regularity, &velocityRand};
+	signalsmith::clap::ParamIndex<> paramIndex;
+	signalsmith::clap::ParamValueStore paramValues; // readable from the main/UI threads
+	signalsmith::clap::ParamChangeQueue stateChanges; // main thread -> audio thread, when loading state while active
+	std::atomic_flag flushRequested = ATOMIC_FLAG_INIT;
+	bool active = false; // only used on the main thread
 	
 	ExampleKeyboard(const clap_host *host) : host(host) {
-		log2Rate.formatFn = [](double value){
-			char text[16] = {};
-			std::snprintf(text, 15, "%.2f Hz", std::exp2(value));
-			return std::string(text);
-		};
+		paramIndex.build(params);
+		paramValues.attach(params);
+		log2Rate.format = signalsmith::clap::ParamFormat::exp2Hz(2);
 		
 		noteSentToMeters.resize(noteManager.polyphony());
 		metersNotes.reserve(noteManager.polyphony());
@@ -110,9 +114,11 @@ struct ExampleKeyboard {
 	}
 	bool pluginActivate(double sRate, uint32_t minFrames, uint32_t maxFrames) {
 		sampleRate = sRate;
+		active = true;
 		return true;
 	}
 	void pluginDeactivate() {
+		active = false;
 	}
 	bool pluginStartProcessing() {
 		return true;
@@ -136,11 +142,8 @@ struct ExampleKeyboard {
 				param->setValueFromEvent(eventParam);
 			} else {
 				// Otherwise, match the ID
-				for (auto *param : params) {
-					if (eventParam.param_id == param->info.id) {
-						param->setValueFromEvent(eventParam);
-						break;
-					}
+				if (auto *param = paramIndex.find(eventParam.param_id)) {
+					param->setValueFromEvent(eventParam);
 				}
 			}
 
@@ -166,6 +169,7 @@ struct ExampleKeyboard {
 		noteManager.startBlock();
 		auto *eventsIn = process->in_events;
 		auto *eventsOut = process->out_events;
+		drainStateChanges(eventsOut);
 		
 		bool hasOutputEvents = outputEventMutex.try_lock(); // OK if we fail, we'll try again very soon - almost certainly faster than the UI refresh rate
 		size_t outputEventIndex = 0;
@@ -320,15 +324,21 @@ struct ExampleKeyboard {
 	// ---- state save/load ----
 	
 	bool stateSave(const clap_ostream_t *stream) {
-		std::vector<unsigned char> bytes;
-		signalsmith::cbor::CborWriter cbor{bytes};
+		// Hands each full buffer to the host between values
+		signalsmith::storage::StreamBuffer out([&](const void *data, size_t length){
+			return signalsmith::clap::writeAllToStream(data, length, stream);
+		});
+		signalsmith::cbor::CborWriter cbor{out.bytes};
+		std::vector<double> values;
+		paramValues.snapshot(values); // consistent, even if the audio thread is changing them
 		cbor.openMap(4);
-		for (auto *param : params) {
-			cbor.addInt(param->info.id); // CBOR keys can be any type
-			cbor.addFloat(param->value);
+		for (size_t i = 0; i < params.size(); ++i) {
+			cbor.addInt(params[i]->info.id); // CBOR keys can be any type
+			cbor.addFloat(values[i]);
+			out.maybeFlush();
 		}
 		stateIsClean.test_and_set();
-		return signalsmith::clap::writeAllToStream(bytes, stream);
+		return out.flush();
 	}
 	bool stateLoad(const clap_istream_t *stream) {
 		std::vector<unsigned char> bytes;
@@ -337,14 +347,23 @@ struct ExampleKeyboard {
 		using Cbor = signalsmith::cbor::CborWalker;
 		Cbor cbor{bytes};
 		if (!cbor.isMap()) return false;
+		bool queued = true;
 		cbor.forEachPair([&](Cbor key, Cbor value){
-			for (auto *param : params) {
-				if (uint32_t(key) == param->info.id) {
+			if (auto *param = paramIndex.find(uint32_t(key))) {
+				if (active) {
+					// The audio thread owns the values while we're active
+					queued = stateChanges.load(*param, double(value)) && queued;
+				} else {
 					param->value = double(value);
+					param->publishValue();
+					param->sentUiState.clear();
 				}
 			}
 		});
-		return true;
+		if (active && hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
+		sentWebviewState.clear();
+		host->request_callback(host);
+		return queued;
 	}
 
 	// ---- audio ports ----
@@ -386,32 +405,20 @@ struct ExampleKeyboard {
 	}
 	
 	bool paramsGetValue(clap_id paramId, double *value) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				*value = param->value;
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		if (!param) return false;
+		*value = param->publishedValue();
+		return true;
 	}
 	
 	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				if (param->formatFn) {
-					auto str = param->formatFn(value);
-					std::strncpy(text, str.c_str(), textCapacity);
-				} else {
-					std::snprintf(text, textCapacity, param->formatString, value);
-				}
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		return param && param->valueToText(value, text, textCapacity);
 	}
 
 	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
-		return false; // not supported
+		auto *param = paramIndex.find(paramId);
+		return param && param->textToValue(text, value);
 	}
 	
 	void paramsFlush(const clap_input_events *eventsIn, const clap_output_events *eventsOut) {
@@ -421,10 +428,19 @@ struct ExampleKeyboard {
 			processEvent(event);
 			eventsOut->try_push(eventsOut, event);
 		}
+		drainStateChanges(eventsOut);
 		for (auto *param : params) {
 			param->sendEvents(eventsOut);
 		}
 	}
+	void drainStateChanges(const clap_output_events *eventsOut) {
+		flushRequested.clear();
+		stateChanges.drain(eventsOut);
+		if (stateChanges.takeLoaded()) {
+			sentWebviewState.clear();
+			host->request_callback(host);
+		}
+	}
 
 	// ---- GUI ----
 	
@@ -505,7 +521,7 @@ struct ExampleKeyboard {
 				cbor.addUtf8(param->key);
 				cbor.openMap(1);
 				cbor.addUtf8("value");
-				cbor.addFloat(param->value);
+				cbor.addFloat(param->publishedValue());
 			}
 			cbor.close();
 			
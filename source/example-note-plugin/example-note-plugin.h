@@ -3,6 +3,7 @@
 #include "signalsmith-clap/cpp.h"
 #include "signalsmith-clap/note-manager.h"
 #include "signalsmith-clap/params.h"
+#include "signalsmith-clap/storage.h"
 
 #include "cbor-walker/cbor-walker.h"
 #include "webview-gui/clap-webview-gui.h"
@@ -68,6 +69,11 @@ struct ExampleNotePlugin {
 	Param regularity{"regularity", "regularity", 0x02468ACE, 0.0, 0.65, 1.0};
 	Param velocityRand{"velocityRand", "velocity rand.", 0x12345678, 0.0, 0.5, 1.0};
 	std::array<Param *, 3> params{&log2Rate, &regularity, &velocityRand};
+	signalsmith::clap::ParamIndex<> paramIndex;
+	signalsmith::clap::ParamValueStore paramValues; // readable from the main/UI threads
+	signalsmith::clap::ParamChangeQueue uiChanges; // UI thread -> audio thread
+	std::atomic_flag flushRequested = ATOMIC_FLAG_INIT;
+	bool active = false; // only used on the main thread
 
 	void resendAllUiState() {
 		// Send everything
@@ -78,12 +84,11 @@ struct ExampleNotePlugin {
 	}
 	
 	ExampleNotePlugin(const clap_host *host) : host(host) {
+		paramIndex.build(params);
+		paramValues.attach(params);
 		outputNotes.resize(noteManager.polyphony());
-		log2Rate.formatFn = [](double value){
-			char text[16] = {};
-			std::snprintf(text, 15, "%.2f Hz", std::exp2(value));
-			return std::string(text);
-		};
+		log2Rate.format = signalsmith::clap::ParamFormat::exp2Hz(2);
+		uiChanges.maxEventRate = 50; // enough to record the shape of a drag
 	}
 
 	// Makes a C function pointer to a C++ method
@@ -123,9 +128,11 @@ struct ExampleNotePlugin {
 	}
 	bool pluginActivate(double sRate, uint32_t minFrames, uint32_t maxFrames) {
 		sampleRate = sRate;
+		active = true;
 		return true;
 	}
 	void pluginDeactivate() {
+		active = false;
 	}
 	bool pluginStartProcessing() {
 		return true;
@@ -145,11 +152,8 @@ struct ExampleNotePlugin {
 				param->setValueFromEvent(eventParam);
 			} else {
 				// Otherwise, match the ID
-				for (auto *param : params) {
-					if (eventParam.param_id == param->info.id) {
-						param->setValueFromEvent(eventParam);
-						break;
-					}
+				if (auto *param = paramIndex.find(eventParam.param_id)) {
+					param->setValueFromEvent(eventParam);
 				}
 			}
 
@@ -165,6 +169,12 @@ struct ExampleNotePlugin {
 	std::uniform_real_distribution<double> unitReal{0, 1};
 	clap_process_status pluginProcess(const clap_process *process) {
 		auto *eventsOut = process->out_events;
+		flushRequested.clear();
+		uiChanges.drain(eventsOut);
+		if (uiChanges.takeLoaded()) {
+			sentWebviewState.clear();
+			host->request_callback(host);
+		}
 
 		noteManager.startBlock();
 		
@@ -308,14 +318,12 @@ struct ExampleNotePlugin {
 			eventsOut->try_push(eventsOut, &clapEvent.header);
 			return;
 		}
-		for (auto &note : noteManager) {
-			if (note.matchEvent(clapEvent, true)) {
-				auto &outNote = outputNotes[note.voiceIndex];
-				clapEvent.note_id = outNote.noteId;
-				eventsOut->try_push(eventsOut, &clapEvent.header);
-				if (!wildcard) break;
-			}
-		}
+		// With a specific note ID, this finds at most one note
+		noteManager.forEachMatchEvent(clapEvent, [&](const NoteManager::Note &note){
+			auto &outNote = outputNotes[note.voiceIndex];
+			clapEvent.note_id = outNote.noteId;
+			eventsOut->try_push(eventsOut, &clapEvent.header);
+		}, true);
 	}
 
 	std::atomic_flag stateIsClean = ATOMIC_FLAG_INIT;
@@ -372,15 +380,21 @@ struct ExampleNotePlugin {
 	// ---- state save/load ----
 	
 	bool stateSave(const clap_ostream_t *stream) {
-		std::vector<unsigned char> bytes;
-		signalsmith::cbor::CborWriter cbor{bytes};
+		// Flushed to the host whenever the buffer fills up (checked after each parameter)
+		signalsmith::storage::StreamBuffer out([&](const void *data, size_t length){
+			return signalsmith::clap::writeAllToStream(data, length, stream);
+		});
+		signalsmith::cbor::CborWriter cbor{out.bytes};
+		std::vector<double> values;
+		paramValues.snapshot(values); // consistent, even if the audio thread is changing them
 		cbor.openMap(4);
-		for (auto *param : params) {
-			cbor.addInt(param->info.id); // CBOR keys can be any type
-			cbor.addFloat(param->value);
+		for (size_t i = 0; i < params.size(); ++i) {
+			cbor.addInt(params[i]->info.id); // CBOR keys can be any type
+			cbor.addFloat(values[i]);
+			out.maybeFlush();
 		}
 		stateIsClean.test_and_set();
-		return signalsmith::clap::writeAllToStream(bytes, stream);
+		return out.flush();
 	}
 	bool stateLoad(const clap_istream_t *stream) {
 		std::vector<unsigned char> bytes;
@@ -389,16 +403,22 @@ struct ExampleNotePlugin {
 		using Cbor = signalsmith::cbor::CborWalker;
 		Cbor cbor{bytes};
 		if (!cbor.isMap()) return false;
+		bool queued = true;
 		cbor.forEachPair([&](Cbor key, Cbor value){
-			for (auto *param : params) {
-				if (uint32_t(key) == param->info.id) {
+			if (auto *param = paramIndex.find(uint32_t(key))) {
+				if (active) {
+					// The audio thread owns the values while we're active
+					queued = uiChanges.load(*param, double(value)) && queued;
+				} else {
 					param->value = double(value);
+					param->publishValue();
 				}
 			}
 		});
+		if (active && hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
 		resendAllUiState();
 		host->request_callback(host);
-		return true;
+		return queued;
 	}
 
 	// ---- audio ports ----
@@ -440,32 +460,20 @@ struct ExampleNotePlugin {
 	}
 	
 	bool paramsGetValue(clap_id paramId, double *value) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				*value = param->value;
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		if (!param) return false;
+		*value = param->publishedValue();
+		return true;
 	}
 	
 	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
-		for (auto *param : params) {
-			if (param->info.id == paramId) {
-				if (param->formatFn) {
-					auto str = param->formatFn(value);
-					std::strncpy(text, str.c_str(), textCapacity);
-				} else {
-					std::snprintf(text, textCapacity, param->formatString, value);
-				}
-				return true;
-			}
-		}
-		return false;
+		auto *param = paramIndex.find(paramId);
+		return param && param->valueToText(value, text, textCapacity);
 	}
 
 	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
-		return false; // not supported
+		auto *param = paramIndex.find(paramId);
+		return param && param->textToValue(text, value);
 	}
 	
 	void paramsFlush(const clap_input_events *eventsIn, const clap_output_events *eventsOut) {
@@ -475,6 +483,13 @@ struct ExampleNotePlugin {
 			processEvent(event);
 			eventsOut->try_push(eventsOut, event);
 		}
+		flushRequested.clear();
+		uiChanges.drain(eventsOut);
+		uiChanges.flushWaiting(eventsOut);
+		if (uiChanges.takeLoaded()) {
+			sentWebviewState.clear();
+			host->request_callback(host);
+		}
 		for (auto *param : params) {
 			param->sendEvents(eventsOut);
 		}
@@ -500,13 +515,12 @@ struct ExampleNotePlugin {
 			cbor.forEachPair([&](Cbor key, Cbor value){
 				auto keyString = key.utf8View();
 				if (keyString == "value" && value.isNumber()) {
-					param.value = value;
-					param.sentValue.clear();
+					uiChanges.value(param, double(value));
 				} else if (keyString == "gesture") {
 					if (bool(value)) {
-						param.sentGestureStart.clear();
+						uiChanges.gestureStart(param);
 					} else {
-						param.sentGestureEnd.clear();
+						uiChanges.gestureEnd(param);
 					}
 				}
 			});
@@ -529,7 +543,8 @@ struct ExampleNotePlugin {
 			}
 		});
 
-		if (hostParams) hostParams->request_flush(host);
+		// Coalesce flush requests until the next time we send the events
+		if (hostParams && !flushRequested.test_and_set()) hostParams->request_flush(host);
 		pluginOnMainThread();
 
 		return !cbor.error();
@@ -546,7 +561,7 @@ struct ExampleNotePlugin {
 			cbor.addUtf8(param->key);
 			cbor.openMap(1);
 			cbor.addUtf8("value");
-			cbor.addFloat(param->value);
+			cbor.addFloat(param->publishedValue());
 		}
 		cbor.close();
 		
@@ -28,13 +28,15 @@ clap_process_status ExampleSynth::pluginProcess(const clap_process *process) {
 	}
 
 	auto &synthOut = process->audio_outputs[0];
-	float sustainAmp = std::pow(10, sustainDb.value/20);
+	double sustainDb = params[paramSustainDb];
+	const float *sustainDbMod = modulation.offsets(paramSustainDb);
 
-	noteManager.startBlock();
-	auto processNoteTask = [&](auto &note) {
+	auto processNoteTask = [&](const NoteManager::Task &note) {
 		auto &osc = oscillators[note.voiceIndex];
+		if (note.state == NoteManager::stateDown) modulation.startVoice(note.voiceIndex, note->noteId);
+		float sustainAmp = std::pow(10, (sustainDb + sustainDbMod[note.voiceIndex])/20);
 
-		auto hz = 440*std::exp2((note.key - 69)/12);
+		auto hz = 440*std::exp2((note->key - 69)/12);
 		auto targetNormFreq = hz/sampleRate;
 
 		auto portamentoMs = 10;
@@ -52,9 +54,9 @@ clap_process_status ExampleSynth::pluginProcess(const clap_process *process) {
 		
 		auto arMs = (note.released() ? 50 : 2);
 		auto arSlew = 1/(arMs*0.001f*sampleRate + 1);
-		auto targetAr = (note.released() ? 0 : note.velocity/4);
+		auto targetAr = (note.released() ? 0 : note->velocity/4);
 		// decay rate
-		auto decayMs = 10 + 490*note.velocity*note.velocity;
+		auto decayMs = 10 + 490*note->velocity*note->velocity;
 		auto decaySlew = 1/(decayMs*0.001f*sampleRate + 1);
 		
 		auto processTo = note.processTo;
@@ -87,26 +89,39 @@ clap_process_status ExampleSynth::pluginProcess(const clap_process *process) {
 			noteManager.stop(note, process->out_events);
 		}
 	};
-	auto processNoteTasks = [&](auto tasks) {
+	auto processNoteTasks = [&](const auto &tasks) {
 		for (auto &task : tasks) processNoteTask(task);
 	};
 
 	auto *eventsIn = process->in_events;
 	auto *eventsOut = process->out_events;
-	uint32_t eventCount = eventsIn->size(eventsIn);
-	for (uint32_t i = 0; i < eventCount; ++i) {
-		auto *event = eventsIn->get(eventsIn, i);
+	auto passEvent = [&](const clap_event_header *event) {
+		processEvent(event);
+		eventsOut->try_push(eventsOut, event);
+	};
+
+	if (std::round(params[paramPolyphony]) != 0) {
+		// Schedule the whole block, then render each voice in one go
+		auto &schedule = noteManager.scheduleBlock(eventsIn, process->frames_count, eventsOut, passEvent);
+		for (auto voice : schedule.voices()) {
+			processNoteTasks(schedule.forVoice(voice));
+		}
+		return CLAP_PROCESS_CONTINUE;
+	}
+
+	// Monophonic legato depends on the existing notes, so we handle each event as it comes
+	noteManager.startBlock();
+	for (auto &input : noteManager.translateEvents(eventsIn)) {
+		auto *event = input.event();
 		if (auto newNote = noteManager.wouldStart(event)) {
 			bool foundLegato = false;
-			if (polyphony.value == 0) {
-				for (auto &otherNote : noteManager) {
-					if (otherNote.channel != newNote->channel || otherNote.port != newNote->port) continue;
-					if (otherNote.released() && otherNote.ageAt(event->time) > sampleRate*0.01f) continue;
-					
-					processNoteTasks(noteManager.legato(*newNote, otherNote, eventsOut));
-					foundLegato = true;
-					break;
-				}
+			for (auto &otherNote : noteManager) {
+				if (otherNote.channel != newNote->channel || otherNote.port != newNote->port) continue;
+				if (otherNote.released() && otherNote.ageAt(event->time) > sampleRate*0.01f) continue;
+				
+				processNoteTasks(noteManager.legato(*newNote, otherNote, eventsOut));
+				foundLegato = true;
+				break;
 			}
 			if (!foundLegato) {
 				processNoteTasks(noteManager.start(*newNote, eventsOut));
@@ -117,8 +132,7 @@ clap_process_status ExampleSynth::pluginProcess(const clap_process *process) {
 			processNoteTasks(noteManager.modNotes(*modNote));
 		}
 		
-		processEvent(event);
-		eventsOut->try_push(eventsOut, event);
+		passEvent(input.original);
 	}
 	
 	processNoteTasks(noteManager.processTo(process->frames_count));
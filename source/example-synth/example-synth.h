@@ -2,6 +2,7 @@
 
 #include "signalsmith-clap/cpp.h"
 #include "signalsmith-clap/note-manager.h"
+#include "signalsmith-clap/params.h"
 
 #include "../plugins.h"
 
@@ -57,17 +58,20 @@ struct ExampleSynth {
 	using NoteManager = signalsmith::clap::NoteManager;
 	NoteManager noteManager{512};
 	
-	struct {
-		clap_id id = 0xCA55E77E;
-		double value = -20;
-	} sustainDb;
-	struct {
-		clap_id id = 0xCA5CADE5;
-		int value = 1;
-	} polyphony;
+	// The parameter table is built at compile time, so each instance only stores the values
+	enum {paramSustainDb, paramPolyphony};
+	static constexpr const char *polyphonyLabels[] = {"monophonic", "polyphonic"};
+	static constexpr signalsmith::clap::ParamSpec paramSpecs[] = {
+		{.key="sustain", .name="sustain", .id=0xCA55E77E, .min=-40, .initial=-20, .max=0, .flags=CLAP_PARAM_IS_AUTOMATABLE|CLAP_PARAM_IS_MODULATABLE|CLAP_PARAM_IS_MODULATABLE_PER_NOTE_ID|CLAP_PARAM_IS_MODULATABLE_PER_KEY|CLAP_PARAM_IS_MODULATABLE_PER_CHANNEL|CLAP_PARAM_IS_MODULATABLE_PER_PORT, .format=signalsmith::clap::ParamFormat::db(0)},
+		{.key="polyphony", .name="polyphony", .id=0xCA5CADE5, .min=0, .initial=1, .max=1, .flags=CLAP_PARAM_IS_AUTOMATABLE|CLAP_PARAM_IS_STEPPED, .format=signalsmith::clap::ParamFormat::enumLabels(polyphonyLabels)}
+	};
+	static constexpr signalsmith::clap::ParamTable paramTable{paramSpecs};
+	signalsmith::clap::TableParams<paramTable> params;
+	signalsmith::clap::ParamModulation modulation; // per-voice offsets, from CLAP_EVENT_PARAM_MOD
 
 	ExampleSynth(const clap_host *host) : host(host) {
 		oscillators.resize(noteManager.polyphony());
+		modulation.resize(paramTable.size(), noteManager.polyphony());
 		noteManager.pitchWheelRange = 48; // MPE
 	}
 
@@ -116,20 +120,20 @@ struct ExampleSynth {
 	}
 	void pluginReset() {
 		noteManager.reset();
+		modulation.reset();
 	}
 	void processEvent(const clap_event_header *event) {
 		if (event->space_id != CLAP_CORE_EVENT_SPACE_ID) return;
 		if (event->type == CLAP_EVENT_PARAM_VALUE) {
-			auto &eventParam = *(const clap_event_param_value *)event;
-			if (eventParam.param_id == sustainDb.id) {
-				sustainDb.value = eventParam.value;
-			} else if (eventParam.param_id == polyphony.id) {
-				polyphony.value = int(std::round(eventParam.value));
-			}
+			params.processEvent(event);
 
 			// Request a callback so we can tell the host our state is dirty
 			stateDirty = true;
 			if (hostState) host->request_callback(host);
+		} else if (event->type == CLAP_EVENT_PARAM_MOD) {
+			auto &modEvent = *(const clap_event_param_mod *)event;
+			int32_t index = params.indexOf(modEvent.param_id);
+			if (index >= 0) modulation.processEvent(modEvent, index, noteManager);
 		}
 	}
 	clap_process_status pluginProcess(const clap_process *process);
@@ -179,19 +183,18 @@ struct ExampleSynth {
 	
 	bool stateSave(const clap_ostream_t *stream) {
 		// very basic string serialisation
-		std::string stateString = (polyphony.value ? "P" : "M") + std::to_string(sustainDb.value);
+		std::string stateString = (std::round(params[paramPolyphony]) ? "P" : "M") + std::to_string(params[paramSustainDb]);
 		return signalsmith::clap::writeAllToStream(stateString, stream);
 	}
 	bool stateLoad(const clap_istream_t *stream) {
 		std::string stateString;
 		if (!signalsmith::clap::readAllFromStream(stateString, stream) || stateString.empty()) return false;
-		polyphony.value = (stateString[0] == 'P' ? 1 : 0);
+		params[paramPolyphony] = (stateString[0] == 'P' ? 1 : 0);
 		auto value = strtod(stateString.c_str() + 1, nullptr);
-		if (value >= -40 && value <= 0) {
-			sustainDb.value = value;
-			return true;
-		}
-		return false;
+		bool valid = (value >= -40 && value <= 0);
+		if (valid) params[paramSustainDb] = value;
+		params.publishAll();
+		return valid;
 	}
 
 	// ---- audio ports ----
@@ -231,70 +234,23 @@ struct ExampleSynth {
 	// ---- parameters ----
 	
 	uint32_t paramsCount() {
-		return 2;
+		return params.paramsCount();
 	}
 	
 	bool paramsGetInfo(uint32_t index, clap_param_info *info) {
-		if (index == 0) {
-			*info = {
-				.id=sustainDb.id,
-				.flags=CLAP_PARAM_IS_AUTOMATABLE,
-				.cookie=nullptr,
-				.name={}, // assigned below
-				.module={},
-				.min_value=-40,
-				.max_value=0,
-				.default_value=-20
-			};
-			std::strncpy(info->name, "sustain", CLAP_NAME_SIZE);
-			return true;
-		} else if (index == 1) {
-			*info = {
-				.id=polyphony.id,
-				.flags=CLAP_PARAM_IS_AUTOMATABLE + CLAP_PARAM_IS_STEPPED,
-				.cookie=nullptr,
-				.name={}, // assigned below
-				.module={},
-				.min_value=0,
-				.max_value=1,
-				.default_value=1
-			};
-			std::strncpy(info->name, "polyphony", CLAP_NAME_SIZE);
-			return true;
-		}
-		return false;
+		return params.paramsGetInfo(index, info);
 	}
 	
 	bool paramsGetValue(clap_id paramId, double *value) {
-		if (paramId == sustainDb.id) {
-			*value = sustainDb.value;
-			return true;
-		} else if (paramId == polyphony.id) {
-			*value = double(polyphony.value);
-		}
-		return false;
+		return params.paramsGetValue(paramId, value);
 	}
 	
 	bool paramsValueToText(clap_id paramId, double value, char *text, uint32_t textCapacity) {
-		if (paramId == sustainDb.id) {
-			std::snprintf(text, textCapacity, "%i dB", int(std::round(value)));
-			return true;
-		} else if (paramId == polyphony.id) {
-			std::strncpy(text, std::round(value) == 0 ? "monophonic" : "polyphonic", textCapacity);
-			return true;
-		}
-		return false;
+		return params.paramsValueToText(paramId, value, text, textCapacity);
 	}
 
 	bool paramsTextToValue(clap_id paramId, const char *text, double *value) {
-		if (paramId == sustainDb.id) {
-			char *numberEnd;
-			*value = std::strtod(text, &numberEnd);
-			if (!(*value >= 50)) *value = 50;
-			if (!(*value <= 500)) *value = 500;
-			return (numberEnd != text);
-		}
-		return false;
+		return params.paramsTextToValue(paramId, text, value);
 	}
 	
 	void paramsFlush(const clap_input_events *eventsIn, const clap_output_events *eventsOut) {